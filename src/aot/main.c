@@ -0,0 +1,482 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include "CHIP8.h"
+#include "aot.h"
+#include "input.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define CPU_FREQ 500
+#define FRAME_RATE 60
+#define IMAGE_MAX (CHIP8_RAM_SIZE - CHIP8_ROM_ADDR)
+
+static uint8_t image[IMAGE_MAX];
+static size_t image_size;
+// padded so lookups one instruction past the end of RAM stay in bounds
+static bool translated[CHIP8_RAM_SIZE + 2];  // a reachable instruction starts here
+static bool leader[CHIP8_RAM_SIZE + 2];      // branch target or other forced block start
+static bool block_start[CHIP8_RAM_SIZE + 2];
+static bool queued[CHIP8_RAM_SIZE];
+static uint16_t worklist[CHIP8_RAM_SIZE];
+static int worklist_len;
+
+static bool in_image(int addr)
+{
+    return addr >= CHIP8_ROM_ADDR && addr + 1 < CHIP8_ROM_ADDR + (int)image_size;
+}
+
+static Instruction instruction_at(uint16_t addr)
+{
+    return (Instruction) { .raw = image[addr - CHIP8_ROM_ADDR] << 8 | image[addr - CHIP8_ROM_ADDR + 1] };
+}
+
+static Opcode opcode_at(uint16_t addr)
+{
+    return DecodeOpcode(instruction_at(addr).raw);
+}
+
+// Instructions after which execution does not simply fall through.
+static bool ends_block(Opcode op)
+{
+    switch (op) {
+        case OP_JP: case OP_CALL: case OP_RET: case OP_JP_VX:
+        case OP_SE_BYTE: case OP_SNE_BYTE: case OP_SE_REG: case OP_SNE_REG:
+        case OP_SKP: case OP_SKNP: case OP_LD_VX_K:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void mark_target(uint16_t addr)
+{
+    addr &= 0xFFF;
+    leader[addr] = true;
+    if (!queued[addr]) {
+        queued[addr] = true;
+        worklist[worklist_len++] = addr;
+    }
+}
+
+// Follows every statically known path from the entry point. Computed jumps
+// and returns are resolved at run time by the dispatcher.
+static void discover(void)
+{
+    mark_target(CHIP8_ROM_ADDR);
+    while (worklist_len > 0) {
+        uint16_t addr = worklist[--worklist_len];
+        while (in_image(addr) && !translated[addr]) {
+            Opcode op = opcode_at(addr);
+            if (op == OP_INVALID) {
+                break; // most likely data; the interpreter handles it if we get there
+            }
+            translated[addr] = true;
+            Instruction in = instruction_at(addr);
+            if (op == OP_JP) {
+                mark_target(in.addr.nnn);
+            } else if (op == OP_CALL) {
+                mark_target(in.addr.nnn);
+                mark_target(addr + 2);
+            } else if (op == OP_LD_VX_K) {
+                leader[addr] = true; // re-entered while waiting for a key
+                mark_target(addr + 2);
+            } else if (ends_block(op) && op != OP_RET && op != OP_JP_VX) {
+                mark_target(addr + 2); // skips
+                mark_target(addr + 4);
+            }
+            if (ends_block(op)) {
+                break;
+            }
+            addr += 2;
+        }
+    }
+    for (int addr = CHIP8_ROM_ADDR; addr < CHIP8_RAM_SIZE; addr++) {
+        if (!translated[addr]) continue;
+        bool falls_in = addr >= 2 && translated[addr - 2] && !ends_block(opcode_at(addr - 2));
+        block_start[addr] = leader[addr] || !falls_in;
+    }
+}
+
+static void emit_goto(FILE *out, int addr)
+{
+    addr &= 0xFFF;
+    if (translated[addr] && block_start[addr]) {
+        fprintf(out, "goto L_%03X;\n", addr);
+    } else {
+        fprintf(out, "{ chip8->program_counter = 0x%03X; goto dispatch; }\n", addr);
+    }
+}
+
+static void emit_skip(FILE *out, uint16_t addr, const char *condition)
+{
+    fprintf(out, "    if (%s) ", condition);
+    emit_goto(out, addr + 4);
+    fprintf(out, "    ");
+    emit_goto(out, addr + 2);
+}
+
+// Emits one instruction; `last` when it is the final one of its block.
+static void emit_instruction(FILE *out, uint16_t addr, bool last)
+{
+    Instruction in = instruction_at(addr);
+    int x = in.nibbles.x, y = in.nibbles.y;
+    char text[64], condition[64];
+    FormatInstruction(in, text, sizeof(text));
+    if (block_start[addr]) {
+        fprintf(out, "    // %s\n", text);
+    } else {
+        fprintf(out, "I_%03X: // %s\n", addr, text);
+    }
+    // the budget runs out at instruction granularity, like the interpreter's
+    fprintf(out, "    if (done == cycles) {\n        chip8->program_counter = 0x%03X;\n        return done;\n    }\n", addr);
+    fprintf(out, "    done++;\n");
+
+    switch (DecodeOpcode(in.raw)) {
+        case OP_CLS:
+            fprintf(out, "    memset(chip8->screen, 0, sizeof(Screen));\n    chip8->screen_changed = 1;\n");
+            break;
+        case OP_RET:
+            fprintf(out, "    chip8->program_counter = chip8->stack[--chip8->stack_pointer];\n    goto dispatch;\n");
+            break;
+        case OP_JP:
+            fprintf(out, "    ");
+            emit_goto(out, in.addr.nnn);
+            break;
+        case OP_CALL:
+            fprintf(out, "    chip8->stack[chip8->stack_pointer++] = 0x%03X;\n    ", (addr + 2) & 0xFFF);
+            emit_goto(out, in.addr.nnn);
+            break;
+        case OP_SE_BYTE:
+            snprintf(condition, sizeof(condition), "V[%d] == 0x%02X", x, in.type6.nn);
+            emit_skip(out, addr, condition);
+            break;
+        case OP_SNE_BYTE:
+            snprintf(condition, sizeof(condition), "V[%d] != 0x%02X", x, in.type6.nn);
+            emit_skip(out, addr, condition);
+            break;
+        case OP_SE_REG:
+            snprintf(condition, sizeof(condition), "V[%d] == V[%d]", x, y);
+            emit_skip(out, addr, condition);
+            break;
+        case OP_SNE_REG:
+            snprintf(condition, sizeof(condition), "V[%d] != V[%d]", x, y);
+            emit_skip(out, addr, condition);
+            break;
+        case OP_SKP:
+            snprintf(condition, sizeof(condition), "chip8->keypad[V[%d] & 0xF]", x);
+            emit_skip(out, addr, condition);
+            break;
+        case OP_SKNP:
+            snprintf(condition, sizeof(condition), "!chip8->keypad[V[%d] & 0xF]", x);
+            emit_skip(out, addr, condition);
+            break;
+        case OP_LD_BYTE:
+            fprintf(out, "    V[%d] = 0x%02X;\n", x, in.type6.nn);
+            break;
+        case OP_ADD_BYTE:
+            fprintf(out, "    V[%d] += 0x%02X;\n", x, in.type6.nn);
+            break;
+        case OP_LD_REG:
+            fprintf(out, "    V[%d] = V[%d];\n", x, y);
+            break;
+        case OP_OR:
+            fprintf(out, "    V[%d] |= V[%d];\n", x, y);
+            break;
+        case OP_AND:
+            fprintf(out, "    V[%d] &= V[%d];\n", x, y);
+            break;
+        case OP_XOR:
+            fprintf(out, "    V[%d] ^= V[%d];\n", x, y);
+            break;
+        // flag updates keep the interpreter's order, which matters when X or Y is VF
+        case OP_ADD_REG:
+            fprintf(out, "    V[15] = (V[%d] + V[%d]) > 0xFF;\n    V[%d] += V[%d];\n", x, y, x, y);
+            break;
+        case OP_SUB:
+            fprintf(out, "    V[15] = V[%d] > V[%d];\n    V[%d] -= V[%d];\n", x, y, x, y);
+            break;
+        case OP_SHR:
+            fprintf(out, "    V[15] = V[%d] & 0x1;\n    V[%d] >>= 1;\n", x, x);
+            break;
+        case OP_SUBN:
+            fprintf(out, "    V[15] = V[%d] > V[%d];\n    V[%d] = V[%d] - V[%d];\n", y, x, x, y, x);
+            break;
+        case OP_SHL:
+            fprintf(out, "    V[15] = (V[%d] & 0x80) >> 7;\n    V[%d] <<= 1;\n", x, x);
+            break;
+        case OP_LD_I:
+            fprintf(out, "    chip8->index = 0x%03X;\n", in.addr.nnn);
+            break;
+        case OP_JP_VX:
+            fprintf(out, "    chip8->program_counter = 0x%03X + V[%d];\n    goto dispatch;\n", in.addr.nnn, x);
+            break;
+        case OP_LD_VX_DT:
+            fprintf(out, "    V[%d] = chip8->delay_timer;\n", x);
+            break;
+        case OP_LD_DT_VX:
+            fprintf(out, "    chip8->delay_timer = V[%d];\n", x);
+            break;
+        case OP_LD_ST_VX:
+            fprintf(out, "    chip8->sound_timer = V[%d];\n", x);
+            break;
+        case OP_ADD_I_VX:
+            fprintf(out, "    chip8->index += V[%d];\n", x);
+            break;
+        case OP_LD_F_VX:
+            fprintf(out, "    chip8->index = V[%d] * 5;\n", x);
+            break;
+        case OP_LD_VX_MEM:
+            for (int i = 0; i <= x; i++) {
+                fprintf(out, "    V[%d] = chip8->ram[chip8->index + %d];\n", i, i);
+            }
+            break;
+        case OP_LD_VX_K:
+            // the interpreter rewinds PC while no key is down
+            fprintf(out, "    chip8->program_counter = 0x%03X;\n", (addr + 2) & 0xFFF);
+            fprintf(out, "    ExecuteInstruction(chip8, (Instruction) { .raw = 0x%04X });\n    goto dispatch;\n", in.raw);
+            break;
+        case OP_LD_B_VX:
+        case OP_LD_MEM_VX:
+            fprintf(out, "    ExecuteInstruction(chip8, (Instruction) { .raw = 0x%04X });\n", in.raw);
+            if (!last) {
+                // self-modifying code: leave before running stale translations
+                fprintf(out, "    if (aot->invalidated) {\n");
+                fprintf(out, "        aot->invalidated = false;\n");
+                fprintf(out, "        chip8->program_counter = 0x%03X;\n        goto dispatch;\n    }\n", (addr + 2) & 0xFFF);
+            }
+            break;
+        default: // DRW and RND go through the interpreter so they can never drift
+            fprintf(out, "    ExecuteInstruction(chip8, (Instruction) { .raw = 0x%04X });\n", in.raw);
+            break;
+    }
+}
+
+static void emit_bytes(FILE *out, const char *name, const uint8_t *bytes, size_t size)
+{
+    fprintf(out, "static const uint8_t %s[%zu] = {", name, size);
+    for (size_t i = 0; i < size; i++) {
+        fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n    ", bytes[i]);
+    }
+    fprintf(out, "\n};\n\n");
+}
+
+static int translate(const char *rom_path, const char *out_path)
+{
+    FILE *rom = fopen(rom_path, "rb");
+    if (!rom) {
+        perror(rom_path);
+        return 1;
+    }
+    image_size = fread(image, 1, sizeof(image), rom);
+    fclose(rom);
+
+    InitializeOpcodes();
+    discover();
+
+    FILE *out = fopen(out_path, "w");
+    if (!out) {
+        perror(out_path);
+        return 1;
+    }
+    fprintf(out, "// Generated by ch8aot from %s. Do not edit.\n", rom_path);
+    fprintf(out, "#include \"aot.h\"\n\n");
+
+    static uint8_t code_map[IMAGE_MAX];
+    int instructions = 0, blocks = 0;
+    for (int addr = CHIP8_ROM_ADDR; addr < CHIP8_RAM_SIZE; addr++) {
+        if (!translated[addr]) continue;
+        code_map[addr - CHIP8_ROM_ADDR] = code_map[addr - CHIP8_ROM_ADDR + 1] = 1;
+        instructions++;
+        blocks += block_start[addr];
+    }
+    emit_bytes(out, "image", image, image_size);
+    emit_bytes(out, "code_map", code_map, image_size);
+
+    fprintf(out, "static int run(CHIP8 *chip8, AotState *aot, int cycles)\n{\n");
+    fprintf(out, "    uint8_t *V = chip8->registers;\n    int done = 0;\n\n");
+    fprintf(out, "dispatch:\n    if (done >= cycles) {\n        return done;\n    }\n");
+    fprintf(out, "    switch (chip8->program_counter) {\n");
+    for (int addr = CHIP8_ROM_ADDR; addr < CHIP8_RAM_SIZE; addr++) {
+        if (!translated[addr]) continue;
+        if (block_start[addr]) {
+            fprintf(out, "        case 0x%03X: goto L_%03X;\n", addr, addr);
+        } else {
+            // entering mid-block after a modification would skip the block check
+            fprintf(out, "        case 0x%03X: if (aot->modified) break; goto I_%03X;\n", addr, addr);
+        }
+    }
+    fprintf(out, "        default: break;\n    }\n");
+    fprintf(out, "interpret:\n    if (done >= cycles) {\n        return done;\n    }\n");
+    fprintf(out, "    ExecuteInstruction(chip8, FetchInstruction(chip8));\n");
+    fprintf(out, "    aot->interpreted++;\n    aot->invalidated = false;\n    done++;\n    goto dispatch;\n");
+
+    for (int start = CHIP8_ROM_ADDR; start < CHIP8_RAM_SIZE; start++) {
+        if (!translated[start] || !block_start[start]) continue;
+        int last = start;
+        while (!ends_block(opcode_at(last)) && translated[last + 2] && !block_start[last + 2]) {
+            last += 2;
+        }
+        fprintf(out, "\nL_%03X:\n", start);
+        fprintf(out, "    if (aot->modified && !AotIntact(aot, chip8, 0x%03X, %d)) {\n", start, last + 2 - start);
+        fprintf(out, "        chip8->program_counter = 0x%03X;\n        goto interpret;\n    }\n", start);
+        for (int addr = start; addr <= last; addr += 2) {
+            emit_instruction(out, addr, addr == last);
+        }
+        if (!ends_block(opcode_at(last))) {
+            fprintf(out, "    ");
+            emit_goto(out, last + 2);
+        }
+    }
+    fprintf(out, "}\n\n");
+    fprintf(out, "const CompiledROM %s = { image, %zu, code_map, run };\n", AOT_SYMBOL, image_size);
+    fclose(out);
+
+    fprintf(stderr, "%s: %d instructions in %d blocks\n", out_path, instructions, blocks);
+    return 0;
+}
+
+static bool same_state(const CHIP8 *a, const CHIP8 *b, const char **what)
+{
+    #define CHECK(field) if (memcmp(&a->field, &b->field, sizeof(a->field)) != 0) { *what = #field; return false; }
+    CHECK(registers) CHECK(screen) CHECK(stack) CHECK(ram) CHECK(keypad) CHECK(prev_keypad)
+    CHECK(delay_timer) CHECK(sound_timer)
+    #undef CHECK
+    if (a->index != b->index) { *what = "index"; return false; }
+    if (a->program_counter != b->program_counter) { *what = "program_counter"; return false; }
+    if (a->stack_pointer != b->stack_pointer) { *what = "stack_pointer"; return false; }
+    return true;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keypad input for a frame without a recording: a deterministic
+// pseudo-random player.
+static uint16_t generated_input(long frame)
+{
+    uint32_t x = (uint32_t)frame * 2654435761u;
+    x ^= x >> 15;
+    return (x & 0x7) == 0 ? 1 << (x >> 4 & 0xF) : 0;
+}
+
+// One frame on recorded input, replayed at the instructions it was made, or
+// on generated input held for the whole frame.
+static void run_frame(CHIP8 *chip8, InputReplay *replay, long frame, int cycles_per_frame)
+{
+    SeedRandom(chip8, frame + 1); // both runs see the same RND sequence
+    int cycles = cycles_per_frame ? cycles_per_frame
+                 : (int)((frame + 1) * CPU_FREQ / FRAME_RATE - frame * CPU_FREQ / FRAME_RATE);
+    if (replay) {
+        InputReplayFrame(replay, chip8, frame, cycles);
+    } else {
+        UpdateKeypad(chip8, generated_input(frame));
+        RunCycles(chip8, cycles);
+    }
+    UpdateTimers(chip8);
+}
+
+static double run_frames(CHIP8 *chip8, long frames, int cycles_per_frame, const InputLog *log)
+{
+    InputReplay replay;
+    if (log) {
+        InputReplayInit(&replay, log);
+    }
+    double start = now_seconds();
+    for (long frame = 0; frame < frames; frame++) {
+        run_frame(chip8, log ? &replay : NULL, frame, cycles_per_frame);
+    }
+    return now_seconds() - start;
+}
+
+static int check(const char *rom, const char *library, long frames, int cycles_per_frame, const char *input_path)
+{
+    static InputLog recording;
+    const InputLog *log = NULL;
+    if (input_path) {
+        if (!InputLogLoad(&recording, input_path)) {
+            return 1;
+        }
+        log = &recording;
+        if (frames == 0) frames = recording.frames;
+    }
+    if (frames == 0) frames = 3600;
+
+    static CHIP8 interpreted, compiled;
+    static AotState aot;
+    InitializeCHIP8(&interpreted);
+    if (LoadROM(&interpreted, rom) < 0) {
+        return 1;
+    }
+    InitializeCHIP8(&compiled);
+    LoadROM(&compiled, rom);
+    if (!AotLoad(&aot, library, &compiled)) {
+        return 1;
+    }
+
+    // lockstep, one frame at a time, to name the first frame that differs
+    InputReplay interpreted_input, compiled_input;
+    if (log) {
+        InputReplayInit(&interpreted_input, log);
+        InputReplayInit(&compiled_input, log);
+    }
+    for (long frame = 0; frame < frames; frame++) {
+        run_frame(&interpreted, log ? &interpreted_input : NULL, frame, cycles_per_frame);
+        run_frame(&compiled, log ? &compiled_input : NULL, frame, cycles_per_frame);
+        const char *what;
+        if (!same_state(&interpreted, &compiled, &what)) {
+            printf("diverged at frame %ld: %s differs (PC 0x%03X vs 0x%03X)\n",
+                frame, what, interpreted.program_counter, compiled.program_counter);
+            AotClose(&aot, &compiled);
+            return 2;
+        }
+    }
+    printf("%ld frames identical\n", frames);
+    AotReport(&aot, stdout);
+
+    // timing runs from a fresh start
+    InitializeCHIP8(&interpreted);
+    LoadROM(&interpreted, rom);
+    InitializeCHIP8(&compiled);
+    LoadROM(&compiled, rom);
+    AotAttach(&aot, aot.rom, &compiled);
+    double interpreter_time = run_frames(&interpreted, frames, cycles_per_frame, log);
+    double compiled_time = run_frames(&compiled, frames, cycles_per_frame, log);
+    double instructions = aot.instructions;
+    printf("interpreter %.2f ns/instr, compiled %.2f ns/instr\n",
+        interpreter_time / instructions * 1e9, compiled_time / instructions * 1e9);
+
+    AotClose(&aot, &compiled);
+    InputLogFree(&recording);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 4 && strcmp(argv[1], "check") == 0) {
+        long frames = 0;
+        int cycles_per_frame = 0;
+        const char *input = NULL;
+        for (int i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+                frames = atol(argv[++i]);
+            } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+                cycles_per_frame = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+                input = argv[++i];
+            }
+        }
+        return check(argv[2], argv[3], frames, cycles_per_frame, input);
+    }
+    if (argc == 3) {
+        return translate(argv[1], argv[2]);
+    }
+    fprintf(stderr, "Usage: %s <ROM file> <output.c>\n", argv[0]);
+    fprintf(stderr, "       %s check <ROM file> <compiled.so> [-f frames] [-c cycles per frame] [-i input]\n", argv[0]);
+    return 1;
+}
@@ -3,18 +3,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <ctype.h>
-#include <assert.h>
+#include <setjmp.h>
+#include <stdbool.h>
 
-
-#define MAX_LABELS 512
-#define MAX_LINE_LEN 128
-#define ROM_START 0x200
-
-typedef struct {
-    char name[32];
-    uint16_t address;
-} Label;
+#include "assembler.h"
 
 Label labels[MAX_LABELS];
 int label_count = 0;
@@ -22,16 +16,37 @@ int label_count = 0;
 uint8_t rom[4096];
 int rom_pos = 0;
 
+ObjectRelocation relocations[MAX_RELOCATIONS];
+int relocation_count = 0;
+
 uint16_t current_address = ROM_START;
 
+static jmp_buf *error_exit; // set while assemble() runs
+static const char *source_path;
+static bool relocatable;    // assembling an object
+static const char *pending_symbol; // label operand of the form being tried
+
+// Reports a source error and abandons the current assembly.
+static void assembly_error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (source_path) fprintf(stderr, "%s: ", source_path);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    if (error_exit) longjmp(*error_exit, 1);
+    exit(1);
+}
+
 void add_label(const char *name, uint16_t addr) {
-    assert(label_count < MAX_LABELS);
+    if (label_count == MAX_LABELS) {
+        assembly_error("Too many labels: %s\n", name);
+    }
     if(strlen(name) >= sizeof(labels[label_count].name)) {
-        fprintf(stderr, "Label name too long: %s\n", name);
-        exit(1);
+        assembly_error("Label name too long: %s\n", name);
     }
     strcpy(labels[label_count].name, name);
     labels[label_count].address = addr;
+    labels[label_count].binding = SYMBOL_LOCAL;
     label_count++;
 }
 
@@ -39,18 +54,52 @@ int is_label(const char *token) {
     return token[strlen(token) - 1] == ':';
 }
 
-uint16_t resolve_label(const char *label) {
+static int find_label(const char *name) {
     for (int i = 0; i < label_count; i++) {
-        if (strcmp(labels[i].name, label) == 0) return labels[i].address;
+        if (strcmp(labels[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+uint16_t resolve_label(const char *label) {
+    if (relocatable) {
+        pending_symbol = label; // the linker fills in the address
+        return 0;
+    }
+    int i = find_label(label);
+    if (i < 0) assembly_error("Unknown label: %s\n", label);
+    return labels[i].address;
+}
+
+// Records that the instruction about to be emitted refers to `name`.
+static void add_relocation(const char *name) {
+    int symbol = find_label(name);
+    if (symbol < 0) {
+        add_label(name, 0);
+        symbol = label_count - 1;
+        labels[symbol].binding = SYMBOL_EXTERN;
+    }
+    if (relocation_count == MAX_RELOCATIONS) {
+        assembly_error("Too many label references\n");
+    }
+    relocations[relocation_count++] = (ObjectRelocation){ .offset = rom_pos, .symbol = symbol };
+}
+
+// GLOBAL name[, name...] exports labels of this file to the linker. A plain
+// ROM has nothing to export them to, so there it only checks the names.
+static void declare_global(char **names, int count) {
+    for (int i = 0; i < count; i++) {
+        int label = find_label(names[i]);
+        if (label < 0 || labels[label].binding == SYMBOL_EXTERN) {
+            assembly_error("GLOBAL of undefined label: %s\n", names[i]);
+        }
+        labels[label].binding = SYMBOL_GLOBAL;
     }
-    fprintf(stderr, "Unknown label: %s\n", label);
-    exit(1);
 }
 
 uint8_t parse_register(const char *tok) {
     if (tok[0] != 'V') {
-        fprintf(stderr, "Invalid register: %s\n", tok);
-        exit(1);
+        assembly_error("Invalid register: %s\n", tok);
     }
     return (uint8_t)strtol(tok + 1, NULL, 16);
 }
@@ -71,16 +120,69 @@ uint16_t parse_addr(const char *tok) {
 }
 
 void emit(uint16_t instr) {
+    if (rom_pos + 2 > MAX_ROM_SIZE) assembly_error("Program does not fit in memory\n");
     rom[rom_pos++] = instr >> 8;
     rom[rom_pos++] = instr & 0xFF;
     current_address += 2;
 }
 
 void emit_byte(uint8_t byte) {
+    if (rom_pos + 1 > MAX_ROM_SIZE) assembly_error("Program does not fit in memory\n");
     rom[rom_pos++] = byte;
     current_address += 1;
 }
 
+int is_register(const char *tok) {
+    return tok[0] == 'V' && isxdigit(tok[1]) && tok[2] == '\0';
+}
+
+// Fills the fields of `op` from the operand tokens. Fails without side
+// effects when the tokens do not fit this form, so the next form can be tried.
+// Fields that share bits (JP Vx, nnn) must agree on them.
+bool encode_operands(Opcode op, char **operands, int count, uint16_t *instr) {
+    const char *spec = Opcodes[op].operands;
+    *instr = Opcodes[op].pattern;
+    uint16_t filled = 0;
+    int i = 0;
+    while (*spec) {
+        size_t len = strcspn(spec, ",");
+        if (i == count) return false;
+        const char *tok = operands[i++];
+        uint16_t value = 0, mask = 0;
+        #define FIELD(name) (len == strlen(name) && strncmp(spec, name, len) == 0)
+        if (FIELD("Vx") || FIELD("Vy")) {
+            if (!is_register(tok)) return false;
+            int shift = FIELD("Vx") ? 8 : 4;
+            value = parse_register(tok) << shift;
+            mask = 0xF << shift;
+        } else if (FIELD("n") || FIELD("nn")) {
+            if (!isdigit(tok[0])) return false;
+            mask = FIELD("n") ? 0xF : 0xFF;
+            value = parse_imm(tok) & mask;
+        } else if (FIELD("nnn")) {
+            if (!isalnum(tok[0]) || is_register(tok)) return false;
+            mask = 0xFFF;
+            value = parse_addr(tok) & mask;
+            if (pending_symbol && (filled & mask)) {
+                assembly_error("%s: the register depends on where %s lands, so it can't be relocated\n",
+                               Opcodes[op].mnemonic, pending_symbol);
+            }
+        } else if (strlen(tok) != len || strncmp(spec, tok, len) != 0) {
+            return false; // literal such as I, DT or [I]
+        }
+        #undef FIELD
+        if ((value ^ *instr) & filled & mask) {
+            assembly_error("%s: V%X must be the first digit of the address\n",
+                           Opcodes[op].mnemonic, *instr >> 8 & 0xF);
+        }
+        *instr |= value;
+        filled |= mask;
+        spec += len;
+        spec += strspn(spec, ", ");
+    }
+    return i == count;
+}
+
 void parse_instruction(char *line) {
     // Remove comments
     char *comment = strchr(line, ';');
@@ -96,55 +198,29 @@ void parse_instruction(char *line) {
     if (tokc == 0) return;
     if (is_label(tokens[0])) return;
 
-    #define R(i) parse_register(tokens[i])
-    #define N(i) parse_imm(tokens[i])
-    #define A(i) parse_addr(tokens[i])
-    #define T(mnem) (strcmp(tokens[0], mnem) == 0)
-    #define is_reg(i) (tokens[i][0] == 'V')
-
-
-    if (T("CLS")) emit(0x00E0);
-    else if (T("RET")) emit(0x00EE);
-    else if (T("JP")) emit(0x1000 | A(1));
-    else if (T("CALL")) emit(0x2000 | A(1));
-    else if (T("SE") && is_reg(1) && !is_reg(2)) emit(0x3000 | (R(1) << 8) | N(2));
-    else if (T("SE") && is_reg(1) && is_reg(2)) emit(0x5000 | (R(1) << 8) | (R(2) << 4));
-    else if (T("SNE") && is_reg(1) && !is_reg(2)) emit(0x4000 | (R(1) << 8) | N(2));
-    else if (T("SNE") && is_reg(1) && is_reg(2)) emit(0x9000 | (R(1) << 8) | (R(2) << 4));
-    else if (T("LD") && is_reg(1) && !is_reg(2)) emit(0x6000 | (R(1) << 8) | N(2));
-    else if (T("LD") && is_reg(1) && is_reg(2)) emit(0x8000 | (R(1) << 8) | (R(2) << 4));
-    else if (T("LD") && strcmp(tokens[1], "I") == 0) emit(0xA000 | A(2));
-    else if (T("LD") && strcmp(tokens[1], "DT") == 0) emit(0xF015 | (R(2) << 8));
-    else if (T("LD") && strcmp(tokens[1], "ST") == 0) emit(0xF018 | (R(2) << 8));
-    else if (T("LD") && strcmp(tokens[2], "DT") == 0) emit(0xF007 | (R(1) << 8));
-    else if (T("LD") && strcmp(tokens[2], "K") == 0) emit(0xF00A | (R(1) << 8));
-    else if (T("LD") && strcmp(tokens[1], "F") == 0) emit(0xF029 | (R(2) << 8));
-    else if (T("LD") && strcmp(tokens[1], "B") == 0) emit(0xF033 | (R(2) << 8));
-    else if (T("LD") && tokens[2][0] == '[' && tokens[2][1] == 'I') emit(0xF055 | (R(1) << 8)); // LD [I], Vx
-    else if (T("LD") && tokens[1][0] == '[' && tokens[1][1] == 'I') emit(0xF065 | (R(2) << 8)); // LD Vx, [I]
-    else if (T("ADD") && is_reg(1)) emit(0x7000 | (R(1) << 8) | N(2));
-    else if (T("ADD") && strcmp(tokens[1], "I") == 0) emit(0xF01E | (R(2) << 8));
-    else if (T("OR")) emit(0x8001 | (R(1) << 8) | (R(2) << 4));
-    else if (T("AND")) emit(0x8002 | (R(1) << 8) | (R(2) << 4));
-    else if (T("XOR")) emit(0x8003 | (R(1) << 8) | (R(2) << 4));
-    else if (T("SUB")) emit(0x8005 | (R(1) << 8) | (R(2) << 4));
-    else if (T("SUBN")) emit(0x8007 | (R(1) << 8) | (R(2) << 4));
-    else if (T("SHR")) emit(0x8006 | (R(1) << 8));
-    else if (T("SHL")) emit(0x800E | (R(1) << 8));
-    else if (T("RND")) emit(0xC000 | (R(1) << 8) | N(2));
-    else if (T("SKP")) emit(0xE09E | (R(1) << 8));
-    else if (T("SKNP")) emit(0xE0A1 | (R(1) << 8));
-    else if (T("DRW")) emit(0xD000 | (R(1) << 8) | (R(2) << 4) | N(3));
-    else if (T("DB")) emit_byte(N(1));
-    else {
-        fprintf(stderr, "Unknown instruction or operand format: %s\n", tokens[0]);
-        exit(1);
+    if (strcmp(tokens[0], "DB") == 0) {
+        emit_byte(parse_imm(tokens[1]));
+        return;
+    }
+    if (strcmp(tokens[0], "GLOBAL") == 0) {
+        declare_global(tokens + 1, tokc - 1);
+        return;
     }
+    for (Opcode op = LookupMnemonic(tokens[0]); op != OP_INVALID; op = NextOpcodeForm(op)) {
+        uint16_t instr;
+        pending_symbol = NULL;
+        if (encode_operands(op, tokens + 1, tokc - 1, &instr)) {
+            if (pending_symbol) add_relocation(pending_symbol);
+            emit(instr);
+            return;
+        }
+    }
+    assembly_error("Unknown instruction or operand format: %s\n", tokens[0]);
 }
 
 void first_pass(FILE *fp) {
     char line[MAX_LINE_LEN];
-    uint16_t addr = ROM_START;
+    uint16_t addr = current_address;
     while (fgets(line, sizeof(line), fp)) {
         char *comment = strchr(line, ';');
         if (comment) *comment = '\0';
@@ -154,25 +230,35 @@ void first_pass(FILE *fp) {
         if (is_label(tok)) {
             tok[strlen(tok) - 1] = '\0';
             add_label(tok, addr);
-        } else {
-            if (strcmp(tok, "DB") == 0) addr += 1;
-            else addr += 2;
+        } else if (strcmp(tok, "DB") == 0) {
+            addr += 1;
+        } else if (strcmp(tok, "GLOBAL") != 0) {
+            addr += 2;
         }
     }
     fseek(fp, 0, SEEK_SET);
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <source.asm> <output.rom>\n", argv[0]);
-        return 1;
+static bool assemble_file(const char *path, bool object) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        perror(path);
+        return false;
     }
+    label_count = 0;
+    rom_pos = 0;
+    relocation_count = 0;
+    relocatable = object;
+    current_address = object ? 0 : ROM_START;
+    source_path = path;
 
-    FILE *in = fopen(argv[1], "r");
-    if (!in) {
-        perror("fopen");
-        return 1;
+    jmp_buf on_error;
+    if (setjmp(on_error)) {
+        error_exit = NULL;
+        fclose(in);
+        return false;
     }
+    error_exit = &on_error;
 
     first_pass(in);
 
@@ -180,11 +266,15 @@ int main(int argc, char *argv[]) {
     while (fgets(line, sizeof(line), in)) {
         parse_instruction(line);
     }
+    error_exit = NULL;
     fclose(in);
+    return true;
+}
 
-    FILE *out = fopen(argv[2], "wb");
-    fwrite(rom, 1, rom_pos, out);
-    fclose(out);
+bool assemble(const char *path) {
+    return assemble_file(path, false);
+}
 
-    return 0;
-}
\ No newline at end of file
+bool assemble_object(const char *path) {
+    return assemble_file(path, true);
+}
@@ -0,0 +1,47 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "opcodes.h"
+#include "object.h"
+
+#define MAX_LABELS 512
+#define MAX_RELOCATIONS 2048
+#define MAX_LINE_LEN 128
+#define ROM_START 0x200
+#define MAX_ROM_SIZE (4096 - ROM_START)
+
+typedef struct {
+    char name[32];
+    uint16_t address;
+    uint8_t binding;         // SYMBOL_*; only objects use more than LOCAL
+} Label;
+
+// Output of the last assemble() call.
+extern Label labels[MAX_LABELS];
+extern int label_count;
+extern uint8_t rom[4096];
+extern int rom_pos;
+extern ObjectRelocation relocations[MAX_RELOCATIONS]; // objects only
+extern int relocation_count;
+
+// Assembles `path` into rom/labels. Errors are printed and return false
+// instead of exiting, so watch mode can wait for the next save.
+bool assemble(const char *path);
+// Assembles `path` as a relocatable object: labels are offsets from 0, every
+// label operand is recorded in `relocations`, and labels that are not
+// defined in the file become SYMBOL_EXTERN instead of an error.
+bool assemble_object(const char *path);
+
+// Assembles each source to an object next to it, `jobs` at a time, skipping
+// those whose object is newer than the source unless `force`. Returns the
+// number of sources that failed.
+int build_objects(char **sources, int count, int jobs, bool force);
+
+// Reassembles `source` into `output` on every save. With a debugger socket,
+// also patches the running emulator; see watch.c.
+int watch(const char *source, const char *output, const char *socket_path);
+
+#endif
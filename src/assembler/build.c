@@ -0,0 +1,78 @@
+// Separate compilation: `ch8asm -c` turns each source into an object next to
+// it. The assembler keeps its state in globals, so sources are assembled in
+// parallel by forked children rather than threads, each with its own copy.
+// Objects only refer to other files by name, so a source is rebuilt only
+// when it is newer than its object.
+#define _POSIX_C_SOURCE 200809L // st_mtim
+#include "assembler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static void object_path(const char *source, char *path, size_t size) {
+    const char *dot = strrchr(source, '.');
+    const char *slash = strrchr(source, '/');
+    int stem = dot && (!slash || dot > slash) ? (int)(dot - source) : (int)strlen(source);
+    snprintf(path, size, "%.*s%s", stem, source, OBJECT_EXTENSION);
+}
+
+static bool up_to_date(const char *source, const char *object) {
+    struct stat src, obj;
+    if (stat(source, &src) != 0 || stat(object, &obj) != 0) return false;
+    if (obj.st_mtim.tv_sec != src.st_mtim.tv_sec) return obj.st_mtim.tv_sec > src.st_mtim.tv_sec;
+    return obj.st_mtim.tv_nsec >= src.st_mtim.tv_nsec;
+}
+
+// Runs in the child: the globals hold this one source's output.
+static bool write_object(const char *source, const char *path) {
+    if (!assemble_object(source)) return false;
+    ObjectSymbol symbols[MAX_LABELS];
+    for (int i = 0; i < label_count; i++) {
+        memcpy(symbols[i].name, labels[i].name, OBJECT_NAME_LEN);
+        symbols[i].offset = labels[i].address;
+        symbols[i].binding = labels[i].binding;
+    }
+    Object object = {
+        .code = rom, .code_size = rom_pos,
+        .symbols = symbols, .symbol_count = label_count,
+        .relocations = relocations, .relocation_count = relocation_count,
+    };
+    return object_write(path, &object);
+}
+
+int build_objects(char **sources, int count, int jobs, bool force) {
+    int failed = 0, running = 0, built = 0;
+    for (int i = 0; i < count || running > 0; ) {
+        if (i < count && running < jobs) {
+            char path[4096];
+            object_path(sources[i], path, sizeof(path));
+            if (!force && up_to_date(sources[i], path)) {
+                i++;
+                continue;
+            }
+            fflush(stderr);
+            pid_t pid = fork();
+            if (pid == 0) {
+                _exit(write_object(sources[i], path) ? 0 : 1);
+            }
+            if (pid < 0) {
+                perror("fork");
+                failed++;
+            } else {
+                running++;
+                built++;
+            }
+            i++;
+            continue;
+        }
+        int status;
+        if (wait(&status) < 0) break;
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+    }
+    fprintf(stderr, "%d of %d objects rebuilt, %d failed\n", built, count, failed);
+    return failed;
+}
@@ -0,0 +1,58 @@
+#include "assembler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+    bool watching = false;
+    bool objects = false, force = false;
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *socket_path = NULL;
+    char pid_socket[64];
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-w") == 0) {
+            watching = true;
+        } else if (strcmp(argv[arg], "-c") == 0) {
+            objects = true;
+        } else if (strcmp(argv[arg], "-B") == 0) {
+            force = true;
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            jobs = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            socket_path = argv[++arg];
+        } else if (strcmp(argv[arg], "-p") == 0 && arg + 1 < argc) {
+            // the emulator's default debugger socket
+            snprintf(pid_socket, sizeof(pid_socket), "/tmp/chip8-%s.sock", argv[++arg]);
+            socket_path = pid_socket;
+        } else {
+            break;
+        }
+    }
+    if (objects && !watching && arg < argc) {
+        return build_objects(argv + arg, argc - arg, jobs > 0 ? jobs : 1, force) ? 1 : 0;
+    }
+    if (argc - arg != 2 || (socket_path && !watching) || objects || force) {
+        fprintf(stderr, "Usage: %s <source.asm> <output.rom>\n", argv[0]);
+        fprintf(stderr, "       %s -w [-p pid | -s socket] <source.asm> <output.rom>\n", argv[0]);
+        fprintf(stderr, "       %s -c [-j jobs] [-B] <source.asm>...\n", argv[0]);
+        return 1;
+    }
+    if (watching) {
+        return watch(argv[arg], argv[arg + 1], socket_path);
+    }
+
+    if (!assemble(argv[arg])) {
+        return 1;
+    }
+    FILE *out = fopen(argv[arg + 1], "wb");
+    if (!out) {
+        perror("Failed to open output file");
+        return 1;
+    }
+    fwrite(rom, 1, rom_pos, out);
+    fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "object.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEADER_SIZE 12
+#define SYMBOL_SIZE (OBJECT_NAME_LEN + 4)
+#define RELOCATION_SIZE 4
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return p[0] | p[1] << 8;
+}
+
+bool object_write(const char *path, const Object *object) {
+    size_t size = HEADER_SIZE + object->code_size + object->symbol_count * SYMBOL_SIZE +
+                  object->relocation_count * RELOCATION_SIZE;
+    uint8_t *data = calloc(1, size);
+    if (!data) return false;
+
+    uint8_t *p = data;
+    put_u16(p, OBJECT_MAGIC & 0xFFFF);
+    put_u16(p + 2, OBJECT_MAGIC >> 16);
+    put_u16(p + 4, OBJECT_VERSION);
+    put_u16(p + 6, object->code_size);
+    put_u16(p + 8, object->symbol_count);
+    put_u16(p + 10, object->relocation_count);
+    p += HEADER_SIZE;
+    memcpy(p, object->code, object->code_size);
+    p += object->code_size;
+    for (int i = 0; i < object->symbol_count; i++, p += SYMBOL_SIZE) {
+        strncpy((char *)p, object->symbols[i].name, OBJECT_NAME_LEN - 1);
+        put_u16(p + OBJECT_NAME_LEN, object->symbols[i].offset);
+        p[OBJECT_NAME_LEN + 2] = object->symbols[i].binding;
+    }
+    for (int i = 0; i < object->relocation_count; i++, p += RELOCATION_SIZE) {
+        put_u16(p, object->relocations[i].offset);
+        put_u16(p + 2, object->relocations[i].symbol);
+    }
+
+    char temp[4096];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *out = fopen(temp, "wb");
+    if (!out) {
+        perror(temp);
+        free(data);
+        return false;
+    }
+    bool ok = fwrite(data, 1, size, out) == size;
+    ok = fclose(out) == 0 && ok;
+    free(data);
+    if (!ok || rename(temp, path) != 0) {
+        perror(path);
+        remove(temp);
+        return false;
+    }
+    return true;
+}
+
+static bool read_error(const char *path, const char *message, uint8_t *data) {
+    fprintf(stderr, "%s: %s\n", path, message);
+    free(data);
+    return false;
+}
+
+bool object_read(const char *path, Object *object) {
+    memset(object, 0, sizeof(*object));
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        perror(path);
+        return false;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t *data = size > 0 ? malloc(size) : NULL;
+    bool ok = data && fread(data, 1, size, in) == (size_t)size;
+    fclose(in);
+    if (!ok || size < HEADER_SIZE) {
+        return read_error(path, "not an object file", data);
+    }
+    if ((get_u16(data) | (uint32_t)get_u16(data + 2) << 16) != OBJECT_MAGIC) {
+        return read_error(path, "not an object file", data);
+    }
+    if (get_u16(data + 4) != OBJECT_VERSION) {
+        return read_error(path, "object format version mismatch, reassemble it", data);
+    }
+    object->code_size = get_u16(data + 6);
+    object->symbol_count = get_u16(data + 8);
+    object->relocation_count = get_u16(data + 10);
+    if (size != HEADER_SIZE + object->code_size + object->symbol_count * SYMBOL_SIZE +
+                object->relocation_count * RELOCATION_SIZE) {
+        return read_error(path, "truncated object file", data);
+    }
+
+    const uint8_t *p = data + HEADER_SIZE;
+    object->code = malloc(object->code_size + 1);
+    object->symbols = calloc(object->symbol_count + 1, sizeof(ObjectSymbol));
+    object->relocations = calloc(object->relocation_count + 1, sizeof(ObjectRelocation));
+    if (!object->code || !object->symbols || !object->relocations) {
+        object_free(object);
+        return read_error(path, "out of memory", data);
+    }
+    memcpy(object->code, p, object->code_size);
+    p += object->code_size;
+    for (int i = 0; i < object->symbol_count; i++, p += SYMBOL_SIZE) {
+        ObjectSymbol *symbol = &object->symbols[i];
+        memcpy(symbol->name, p, OBJECT_NAME_LEN - 1);
+        symbol->offset = get_u16(p + OBJECT_NAME_LEN);
+        symbol->binding = p[OBJECT_NAME_LEN + 2];
+        if (symbol->binding > SYMBOL_EXTERN || (symbol->binding != SYMBOL_EXTERN && symbol->offset > object->code_size)) {
+            object_free(object);
+            return read_error(path, "bad symbol", data);
+        }
+    }
+    for (int i = 0; i < object->relocation_count; i++, p += RELOCATION_SIZE) {
+        ObjectRelocation *relocation = &object->relocations[i];
+        relocation->offset = get_u16(p);
+        relocation->symbol = get_u16(p + 2);
+        if (relocation->offset + 2 > object->code_size || relocation->symbol >= object->symbol_count) {
+            object_free(object);
+            return read_error(path, "bad relocation", data);
+        }
+    }
+    free(data);
+    return true;
+}
+
+void object_free(Object *object) {
+    free(object->code);
+    free(object->symbols);
+    free(object->relocations);
+    memset(object, 0, sizeof(*object));
+}
@@ -0,0 +1,58 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Relocatable objects, written by `ch8asm -c` and linked by `ch8ld`. An
+// object holds one section of code and data assembled at offset 0. Every
+// label operand becomes a relocation: the linker adds the symbol's final
+// address to the 12-bit address field of the instruction at that offset.
+//
+//   u32 magic, u16 version, u16 code size, u16 symbol count,
+//   u16 relocation count, u8 code[code size],
+//   symbols: char name[32], u16 offset, u8 binding, u8 reserved
+//   relocations: u16 offset, u16 symbol index
+//
+// All integers are little endian.
+
+#define OBJECT_MAGIC 0x424F3843 // "C8OB"
+#define OBJECT_VERSION 1
+#define OBJECT_NAME_LEN 32
+#define OBJECT_EXTENSION ".o8"
+
+enum {
+    SYMBOL_LOCAL,            // visible to this object only
+    SYMBOL_GLOBAL,           // exported with GLOBAL
+    SYMBOL_EXTERN,           // used here, defined in another object
+};
+
+typedef struct {
+    char name[OBJECT_NAME_LEN];
+    uint16_t offset;         // into the section; unused for SYMBOL_EXTERN
+    uint8_t binding;
+} ObjectSymbol;
+
+typedef struct {
+    uint16_t offset;         // of the instruction whose low 12 bits are patched
+    uint16_t symbol;
+} ObjectRelocation;
+
+typedef struct {
+    uint8_t *code;
+    int code_size;
+    ObjectSymbol *symbols;
+    int symbol_count;
+    ObjectRelocation *relocations;
+    int relocation_count;
+} Object;
+
+// Writes to a temporary file and renames it over `path`, so a failed or
+// interrupted build never leaves a truncated object that looks up to date.
+bool object_write(const char *path, const Object *object);
+// Reads and checks an object; the arrays are allocated and freed with
+// object_free.
+bool object_read(const char *path, Object *object);
+void object_free(Object *object);
+
+#endif
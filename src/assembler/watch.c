@@ -0,0 +1,329 @@
+// Watch mode: reassemble on save and hot-patch a running emulator through
+// its debugger socket. Attaching halts the emulator at the next frame
+// boundary, so all of a patch lands between two frames; registers, screen
+// and timers are left alone, and PC and return addresses that sit in code
+// that moved are relocated through the label map.
+#define _GNU_SOURCE // inotify, SOCK_CLOEXEC
+#include "assembler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define MERGE_GAP 4        // changed ranges closer than this are sent as one
+#define PATCH_CHUNK 1024   // bytes per M packet, well under the stub's packet size
+#define SETTLE_MS 50       // editors often write a file in several steps
+
+typedef struct {
+    Label labels[MAX_LABELS];
+    int label_count;
+    uint8_t image[MAX_ROM_SIZE];
+    int size;
+} Build;
+
+typedef struct {
+    int start, end;        // offsets into the image, end exclusive
+} Range;
+
+static Build previous;     // what the emulator is running, as far as we know
+static Build current;
+static bool have_previous;
+
+static void save_build(Build *build) {
+    memcpy(build->labels, labels, label_count * sizeof(Label));
+    build->label_count = label_count;
+    memcpy(build->image, rom, rom_pos);
+    memset(build->image + rom_pos, 0, MAX_ROM_SIZE - rom_pos);
+    build->size = rom_pos;
+}
+
+// Bytes that differ between the two builds; a shrunk program has its old
+// tail cleared.
+static int diff_builds(const Build *old, const Build *new, Range *ranges) {
+    int count = 0;
+    int size = old->size > new->size ? old->size : new->size;
+    for (int i = 0; i < size; i++) {
+        if (old->image[i] == new->image[i]) continue;
+        if (count > 0 && i - ranges[count - 1].end < MERGE_GAP) {
+            ranges[count - 1].end = i + 1;
+        } else {
+            ranges[count++] = (Range){ i, i + 1 };
+        }
+    }
+    return count;
+}
+
+static const Label *find_label(const Build *build, const char *name) {
+    for (int i = 0; i < build->label_count; i++) {
+        if (strcmp(build->labels[i].name, name) == 0) return &build->labels[i];
+    }
+    return NULL;
+}
+
+// The label whose block holds `addr`: the closest one at or before it that
+// still exists in the new build.
+static const Label *enclosing_label(uint16_t addr) {
+    const Label *best = NULL;
+    for (int i = 0; i < previous.label_count; i++) {
+        const Label *label = &previous.labels[i];
+        if (label->address <= addr && (!best || label->address > best->address) &&
+            find_label(&current, label->name)) {
+            best = label;
+        }
+    }
+    return best;
+}
+
+static const char *label_at(const Build *build, uint16_t addr) {
+    for (int i = 0; i < build->label_count; i++) {
+        if (build->labels[i].address == addr) return build->labels[i].name;
+    }
+    return NULL;
+}
+
+// Two instructions do the same thing if their bytes match, or if they jump,
+// call or point I at the same label wherever that label now is.
+static bool same_instruction(uint16_t old, uint16_t new) {
+    if (old == new) return true;
+    int kind = old >> 12;
+    if ((kind != 0x1 && kind != 0x2 && kind != 0xA && kind != 0xB) || kind != new >> 12) {
+        return false;
+    }
+    const char *old_target = label_at(&previous, old & 0xFFF);
+    const char *new_target = label_at(&current, new & 0xFFF);
+    return old_target && new_target && strcmp(old_target, new_target) == 0;
+}
+
+static bool same_code(const uint8_t *old, const uint8_t *new, int length) {
+    for (int i = 0; i < length; i += 2) {
+        if (i + 1 == length) return old[i] == new[i];
+        if (!same_instruction(old[i] << 8 | old[i + 1], new[i] << 8 | new[i + 1])) return false;
+    }
+    return true;
+}
+
+// Where `addr` in the old program is in the new one. If the code from its
+// label up to `addr` still does the same thing the offset is kept; otherwise
+// execution restarts at the label, the nearest point known to mean the same.
+static uint16_t relocate(uint16_t addr) {
+    if (addr < ROM_START || addr >= ROM_START + previous.size) {
+        return addr;
+    }
+    const Label *old_label = enclosing_label(addr);
+    if (!old_label) {
+        return addr;
+    }
+    const Label *new_label = find_label(&current, old_label->name);
+    int offset = addr - old_label->address;
+    if (new_label->address + offset > ROM_START + current.size ||
+        !same_code(previous.image + (old_label->address - ROM_START),
+                   current.image + (new_label->address - ROM_START), offset)) {
+        return new_label->address;
+    }
+    return new_label->address + offset;
+}
+
+static int connect_emulator(const char *socket_path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    struct timeval timeout = { .tv_sec = 2 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Cannot reach emulator at %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends one remote protocol packet and waits for its reply.
+static bool command(int fd, const char *payload, char *reply, size_t reply_size) {
+    char packet[2 * PATCH_CHUNK + 64];
+    uint8_t checksum = 0;
+    for (const char *c = payload; *c; c++) checksum += (uint8_t)*c;
+    int n = snprintf(packet, sizeof(packet), "$%s#%02x", payload, checksum);
+    if (send(fd, packet, n, MSG_NOSIGNAL) != n) return false;
+
+    size_t len = 0;
+    bool in_packet = false;
+    for (;;) {
+        char c;
+        if (recv(fd, &c, 1, 0) != 1) return false;
+        if (!in_packet) {
+            in_packet = c == '$'; // skip acks
+            continue;
+        }
+        if (c == '#') break;
+        if (len + 1 < reply_size) reply[len++] = c;
+    }
+    char sum[2];
+    if (recv(fd, sum, 2, MSG_WAITALL) != 2) return false;
+    reply[len] = '\0';
+    send(fd, "+", 1, MSG_NOSIGNAL);
+    return true;
+}
+
+static void put_hex(char *out, const uint8_t *bytes, int len) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < len; i++) {
+        *out++ = digits[bytes[i] >> 4];
+        *out++ = digits[bytes[i] & 0xF];
+    }
+    *out = '\0';
+}
+
+static bool parse_hex(const char *hex, uint8_t *bytes, int len) {
+    for (int i = 0; i < len; i++) {
+        unsigned value;
+        if (sscanf(hex + 2 * i, "%2x", &value) != 1) return false;
+        bytes[i] = value;
+    }
+    return true;
+}
+
+// Writes the changed ranges and relocates PC and the return addresses on
+// the stack.
+static bool patch(const char *socket_path, const Range *ranges, int count) {
+    int fd = connect_emulator(socket_path);
+    if (fd < 0) return false;
+    char payload[2 * PATCH_CHUNK + 64], reply[256];
+    bool ok = command(fd, "?", reply, sizeof(reply)); // halted once this answers
+    if (ok && reply[0] != 'S' && reply[0] != 'T') {
+        fprintf(stderr, "Emulator busy, is a debugger attached?\n");
+        ok = false;
+    }
+
+    for (int i = 0; ok && i < count; i++) {
+        for (int start = ranges[i].start; ok && start < ranges[i].end; start += PATCH_CHUNK) {
+            int len = ranges[i].end - start < PATCH_CHUNK ? ranges[i].end - start : PATCH_CHUNK;
+            int n = snprintf(payload, sizeof(payload), "M%x,%x:", ROM_START + start, len);
+            put_hex(payload + n, current.image + start, len);
+            ok = command(fd, payload, reply, sizeof(reply)) && strcmp(reply, "OK") == 0;
+        }
+    }
+
+    uint8_t bytes[1 + 2 * 16];
+    if (ok) ok = command(fd, "p11", reply, sizeof(reply)) && parse_hex(reply, bytes, 2);
+    if (ok) {
+        uint16_t pc = bytes[0] | bytes[1] << 8, moved = relocate(pc);
+        if (moved != pc) {
+            printf("  PC %03X -> %03X\n", pc, moved);
+            uint8_t value[2] = { moved & 0xFF, moved >> 8 };
+            put_hex(payload + snprintf(payload, sizeof(payload), "P11="), value, 2);
+            ok = command(fd, payload, reply, sizeof(reply)) && strcmp(reply, "OK") == 0;
+        }
+    }
+    if (ok) ok = command(fd, "qC8.stack", reply, sizeof(reply)) && parse_hex(reply, bytes, sizeof(bytes));
+    if (ok) {
+        bool moved_any = false;
+        for (int i = 0; i < (bytes[0] & 0xF); i++) {
+            uint16_t address = bytes[1 + 2 * i] | bytes[2 + 2 * i] << 8, moved = relocate(address);
+            if (moved != address) {
+                printf("  return address %03X -> %03X\n", address, moved);
+                bytes[1 + 2 * i] = moved & 0xFF;
+                bytes[2 + 2 * i] = moved >> 8;
+                moved_any = true;
+            }
+        }
+        if (moved_any) {
+            put_hex(payload + snprintf(payload, sizeof(payload), "QC8.stack:"), bytes, sizeof(bytes));
+            ok = command(fd, payload, reply, sizeof(reply)) && strcmp(reply, "OK") == 0;
+        }
+    }
+
+    command(fd, "D", reply, sizeof(reply)); // detaching resumes the emulator
+    close(fd);
+    if (!ok) fprintf(stderr, "Patch failed, the next save will retry it\n");
+    return ok;
+}
+
+static bool write_output(const char *output) {
+    FILE *out = fopen(output, "wb");
+    if (!out) {
+        perror(output);
+        return false;
+    }
+    fwrite(current.image, 1, current.size, out);
+    fclose(out);
+    return true;
+}
+
+static void rebuild(const char *source, const char *output, const char *socket_path) {
+    if (!assemble(source)) {
+        fprintf(stderr, "%s: not assembled, keeping the previous image\n", source);
+        return;
+    }
+    save_build(&current);
+    if (!have_previous) {
+        write_output(output);
+        printf("%s: %d bytes, %d labels\n", output, current.size, current.label_count);
+        previous = current;
+        have_previous = true;
+        return;
+    }
+    static Range ranges[MAX_ROM_SIZE];
+    int count = diff_builds(&previous, &current, ranges);
+    if (count == 0) {
+        printf("%s: no change\n", source);
+        return;
+    }
+    write_output(output);
+    int changed = 0;
+    for (int i = 0; i < count; i++) changed += ranges[i].end - ranges[i].start;
+    printf("%s: %d bytes changed in %d ranges\n", output, changed, count);
+    if (!socket_path || patch(socket_path, ranges, count)) {
+        previous = current;
+    }
+    fflush(stdout);
+}
+
+int watch(const char *source, const char *output, const char *socket_path) {
+    char dir_buffer[4096], base_buffer[4096];
+    snprintf(dir_buffer, sizeof(dir_buffer), "%s", source);
+    snprintf(base_buffer, sizeof(base_buffer), "%s", source);
+    const char *dir = dirname(dir_buffer), *base = basename(base_buffer);
+
+    // watch the directory: editors often save by renaming a new file over the old
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        perror(dir);
+        return 1;
+    }
+    rebuild(source, output, socket_path);
+    fflush(stdout);
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(fd, events, sizeof(events));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            perror("inotify");
+            return 1;
+        }
+        bool touched = false;
+        for (char *p = events; p < events + n; ) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            if (event->len && strcmp(event->name, base) == 0) touched = true;
+            p += sizeof(*event) + event->len;
+        }
+        if (!touched) continue;
+        // let the save finish, then drain whatever else it generated
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        while (poll(&pfd, 1, SETTLE_MS) > 0) {
+            if (read(fd, events, sizeof(events)) <= 0) break;
+        }
+        rebuild(source, output, socket_path);
+    }
+}
@@ -0,0 +1,142 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, getopt
+#include "CHIP8.h"
+#include "input.h"
+#include "postprocess.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CPU_FREQ 500
+#define FRAME_RATE 60
+
+// Runs a ROM headless and writes post-processed frames as PPM images, the
+// same pixels the window would show. Without -o it only times the
+// post-processing.
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Keypad input for a frame without a recording: a key now and then so
+// menus move on.
+static uint16_t generated_input(long frame)
+{
+    uint32_t x = (uint32_t)frame * 2654435761u;
+    x ^= x >> 15;
+    return (x & 0x7) == 0 ? 1 << (x >> 4 & 0xF) : 0;
+}
+
+static bool write_ppm(const PostProcess *post, const char *prefix, long frame)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%05ld.ppm", prefix, frame);
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        perror(path);
+        return false;
+    }
+    fprintf(out, "P6\n%d %d\n255\n", post->width, post->height);
+    uint8_t *row = malloc(post->width * 3);
+    for (int y = 0; y < post->height; y++) {
+        const uint32_t *pixels = post->pixels + (size_t)y * post->width;
+        for (int x = 0; x < post->width; x++) {
+            row[3 * x] = pixels[x] >> 16;
+            row[3 * x + 1] = pixels[x] >> 8;
+            row[3 * x + 2] = pixels[x];
+        }
+        fwrite(row, 3, post->width, out);
+    }
+    free(row);
+    fclose(out);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    PostProcess post = { .scale = 10 };
+    PostProcessParsePalette("white", &post.palette);
+    long frames = 600, every = 0;
+    int cpu_freq = CPU_FREQ;
+    const char *prefix = NULL;
+    const char *input_path = NULL;
+    bool usage = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:e:i:c:s:x:p:P:So:")) != -1) {
+        switch (opt) {
+            case 'f': frames = atol(optarg); break;
+            case 'e': every = atol(optarg); break;
+            case 'i': input_path = optarg; break;
+            case 'c': cpu_freq = atoi(optarg); break;
+            case 's': post.scale = atoi(optarg); break;
+            case 'x': usage |= !PostProcessParseScaler(optarg, &post.scaler); break;
+            case 'p': usage |= !PostProcessParsePalette(optarg, &post.palette); break;
+            case 'P': post.persistence = atoi(optarg); break;
+            case 'S': post.scanlines = true; break;
+            case 'o': prefix = optarg; break;
+            default: usage = true; break;
+        }
+    }
+    if (usage || optind != argc - 1 || frames <= 0 || every < 0 || cpu_freq <= 0) {
+        fprintf(stderr, "Usage: %s [-f frames] [-e every] [-i recording] [-c cycles/s] [-s scale] "
+                        "[-x nearest|epx] [-p palette] [-P persistence %%] [-S] [-o prefix] <ROM>\n", argv[0]);
+        return 1;
+    }
+    if (!PostProcessInit(&post)) {
+        return 1;
+    }
+
+    InputLog recording = { 0 };
+    InputReplay replay;
+    if (input_path) {
+        if (!InputLogLoad(&recording, input_path)) {
+            return 1;
+        }
+        InputReplayInit(&replay, &recording);
+    }
+    static CHIP8 chip8;
+    InitializeCHIP8(&chip8);
+    if (LoadROM(&chip8, argv[optind]) < 0) {
+        return 1;
+    }
+
+    uint64_t *times = malloc(frames * sizeof(uint64_t));
+    for (long frame = 0; frame < frames; frame++) {
+        int cycles = (int)((frame + 1) * cpu_freq / FRAME_RATE - frame * cpu_freq / FRAME_RATE);
+        if (input_path) {
+            InputReplayFrame(&replay, &chip8, frame, cycles);
+        } else {
+            UpdateKeypad(&chip8, generated_input(frame));
+            RunCycles(&chip8, cycles);
+        }
+        UpdateTimers(&chip8);
+
+        uint64_t start = now_ns();
+        PostProcessFrame(&post, chip8.screen);
+        times[frame] = now_ns() - start;
+
+        bool capture = every ? frame % every == every - 1 : frame == frames - 1;
+        if (prefix && capture && !write_ppm(&post, prefix, frame)) {
+            return 1;
+        }
+    }
+
+    qsort(times, frames, sizeof(uint64_t), compare_u64);
+    printf("%ld frames at %dx%d: post-processing p50 %.1f us, p99 %.1f us, max %.1f us\n",
+        frames, post.width, post.height, times[frames / 2] / 1e3, times[frames * 99 / 100] / 1e3,
+        times[frames - 1] / 1e3);
+    free(times);
+    InputLogFree(&recording);
+    PostProcessFree(&post);
+    return 0;
+}
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include "protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Local stand-in for a remote viewer: connects to chip8d, applies frame
+// diffs, acknowledges them and optionally mashes keys.
+
+typedef uint64_t Frame[32];
+
+typedef struct {
+    int fd;
+    uint32_t session;
+    bool welcomed;
+    uint8_t input[4096];
+    size_t input_len;
+    Frame frames[CHIP8D_HISTORY];
+    uint32_t frame_seq[CHIP8D_HISTORY];
+    uint32_t seq;           // newest frame applied
+    uint64_t frame_count;
+    uint64_t bytes;
+    uint64_t bad_base;      // diffs against a frame we no longer have
+} Viewer;
+
+static const char *socket_path;
+static int port;
+
+static int connect_server(void)
+{
+    int fd;
+    if (socket_path) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(port),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+        int one = 1;
+        if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+static void send_message(Viewer *viewer, uint8_t type, const uint8_t *payload, uint16_t length)
+{
+    uint8_t message[CHIP8D_HEADER_SIZE + 8];
+    memcpy(put_header(message, type, length), payload, length);
+    send(viewer->fd, message, CHIP8D_HEADER_SIZE + length, MSG_NOSIGNAL);
+}
+
+static void apply_frame(Viewer *viewer, const uint8_t *payload, uint16_t length)
+{
+    uint32_t seq = get_u32(payload);
+    uint32_t base = get_u32(payload + 4);
+    uint32_t mask = get_u32(payload + 8);
+    const uint64_t *from = NULL;
+    static const Frame blank;
+    if (base == 0) {
+        from = blank;
+    } else if (viewer->frame_seq[base % CHIP8D_HISTORY] == base) {
+        from = viewer->frames[base % CHIP8D_HISTORY];
+    } else {
+        viewer->bad_base++;
+        return;
+    }
+    Frame next;
+    const uint8_t *rows = payload + 12;
+    for (int row = 0; row < 32; row++) {
+        next[row] = from[row];
+        if (mask & (1u << row)) {
+            if (rows + 8 > payload + length) return;
+            next[row] ^= get_u64(rows);
+            rows += 8;
+        }
+    }
+    memcpy(viewer->frames[seq % CHIP8D_HISTORY], next, sizeof(Frame));
+    viewer->frame_seq[seq % CHIP8D_HISTORY] = seq;
+    viewer->seq = seq;
+    viewer->frame_count++;
+
+    uint8_t ack[4];
+    put_u32(ack, seq);
+    send_message(viewer, MSG_ACK, ack, sizeof(ack));
+}
+
+static bool read_viewer(Viewer *viewer)
+{
+    ssize_t n = recv(viewer->fd, viewer->input + viewer->input_len, sizeof(viewer->input) - viewer->input_len, 0);
+    if (n <= 0) {
+        return false;
+    }
+    viewer->input_len += n;
+    viewer->bytes += n;
+
+    size_t pos = 0;
+    while (viewer->input_len - pos >= CHIP8D_HEADER_SIZE) {
+        uint8_t type = viewer->input[pos];
+        uint16_t length = get_u16(viewer->input + pos + 1);
+        if (viewer->input_len - pos < CHIP8D_HEADER_SIZE + length) break;
+        const uint8_t *payload = viewer->input + pos + CHIP8D_HEADER_SIZE;
+        if (type == MSG_WELCOME && length >= 5) {
+            if (payload[4] != 0) {
+                fprintf(stderr, "session %u refused\n", get_u32(payload));
+                return false;
+            }
+            viewer->welcomed = true;
+        } else if (type == MSG_FRAME && length >= 12) {
+            apply_frame(viewer, payload, length);
+        }
+        pos += CHIP8D_HEADER_SIZE + length;
+    }
+    memmove(viewer->input, viewer->input + pos, viewer->input_len - pos);
+    viewer->input_len -= pos;
+    return true;
+}
+
+static void print_screen(const Viewer *viewer)
+{
+    const uint64_t *screen = viewer->frames[viewer->seq % CHIP8D_HISTORY];
+    for (int row = 0; row < 32; row++) {
+        char line[65];
+        for (int col = 0; col < 64; col++) {
+            line[col] = (screen[row] >> (63 - col)) & 1 ? '#' : ' ';
+        }
+        line[64] = '\0';
+        printf("|%s|\n", line);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t first_session = 0;
+    int connections = 1;
+    long frames = 300;
+    bool mash_keys = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            first_session = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            connections = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            frames = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-k") == 0) {
+            mash_keys = true;
+        } else {
+            socket_path = NULL;
+            port = 0;
+            break;
+        }
+    }
+    if ((!socket_path && !port) || connections <= 0) {
+        fprintf(stderr, "Usage: %s (-u socket | -p port) [-s session] [-n connections] [-f frames] [-k]\n", argv[0]);
+        return 1;
+    }
+
+    Viewer *viewers = calloc(connections, sizeof(Viewer));
+    struct pollfd *fds = calloc(connections, sizeof(struct pollfd));
+    if (!viewers || !fds) {
+        perror("Failed to allocate viewers");
+        return 1;
+    }
+    for (int i = 0; i < connections; i++) {
+        viewers[i].fd = connect_server();
+        if (viewers[i].fd < 0) {
+            perror("Failed to connect");
+            return 1;
+        }
+        viewers[i].session = first_session + i;
+        uint8_t hello[4];
+        put_u32(hello, viewers[i].session);
+        send_message(&viewers[i], MSG_HELLO, hello, sizeof(hello));
+        fds[i] = (struct pollfd) { .fd = viewers[i].fd, .events = POLLIN };
+    }
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    srand(start.tv_nsec);
+    int open = connections;
+    // the first viewer paces the run
+    while (open > 0 && viewers[0].fd >= 0 && viewers[0].frame_count < (uint64_t)frames) {
+        if (poll(fds, connections, 1000) <= 0) {
+            break;
+        }
+        for (int i = 0; i < connections; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            if (!read_viewer(&viewers[i])) {
+                close(viewers[i].fd);
+                viewers[i].fd = fds[i].fd = -1;
+                open--;
+                continue;
+            }
+            if (mash_keys && viewers[i].welcomed && rand() % 8 == 0) {
+                uint8_t keys[2];
+                put_u16(keys, 1 << (rand() % 16));
+                send_message(&viewers[i], MSG_KEYS, keys, sizeof(keys));
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (viewers[0].welcomed) {
+        print_screen(&viewers[0]);
+    }
+    uint64_t total_frames = 0, total_bytes = 0, bad = 0;
+    for (int i = 0; i < connections; i++) {
+        total_frames += viewers[i].frame_count;
+        total_bytes += viewers[i].bytes;
+        bad += viewers[i].bad_base;
+        if (viewers[i].fd >= 0) close(viewers[i].fd);
+    }
+    printf("%d connections, %.1f s: %llu frames, %llu bytes (%.1f bytes/frame), %llu unresolved diffs\n",
+        connections, seconds, (unsigned long long)total_frames, (unsigned long long)total_bytes,
+        total_frames ? (double)total_bytes / total_frames : 0.0, (unsigned long long)bad);
+    return bad ? 2 : 0;
+}
@@ -1,9 +1,28 @@
 #include "CHIP8.h"
+#include "aot.h"
+#include "debugger.h"
+#include "fusion.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// xorshift32: a few shifts, and the whole generator is one word of state
+static uint8_t next_random(CHIP8 *chip8)
+{
+    uint32_t x = chip8->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8->random_state = x;
+    return x >> 24;
+}
 
 Instruction FetchInstruction(CHIP8 *chip8)
 {
+    if (chip8->debugger && DebuggerCheckFetch(chip8->debugger, chip8->program_counter)) {
+        return (Instruction) { .raw = 0x0000 }; // breakpoint: PC stays put, the no-op is discarded
+    }
     chip8->program_counter += 2;
     return (Instruction) {
         .raw = (chip8->ram[chip8->program_counter - 2] << 8) | chip8->ram[chip8->program_counter - 1]
@@ -12,129 +31,113 @@ Instruction FetchInstruction(CHIP8 *chip8)
 
 void ExecuteInstruction(CHIP8 *chip8, Instruction instruction)
 {
-    switch (instruction.opcode) {
-        case 0x0: 
-            switch (instruction.raw)
-            {
-            case 0x00E0: // CLS
-                for (int i = 0; i < 32; i++) {
-                    chip8->screen[i] = 0;
-                }
-                chip8->screen_changed = 1;
-                break;
-                case 0x00EE: // RET
-                chip8->program_counter = chip8->stack[--chip8->stack_pointer];
-                break;    
-            default:
-                break;
-            }            
-            break;
-        case 0x1: // JMP
+    switch (DecodeOpcode(instruction.raw)) {
+        case OP_CLS:
+            for (int i = 0; i < 32; i++) {
+                chip8->screen[i] = 0;
+            }
+            chip8->screen_changed = 1;
+            break;
+        case OP_RET:
+            chip8->program_counter = chip8->stack[--chip8->stack_pointer];
+            break;
+        case OP_JP:
             chip8->program_counter = instruction.addr.nnn;
             break;
-        case 0x2: // CALL
+        case OP_CALL:
             chip8->stack[chip8->stack_pointer++] = chip8->program_counter;
             chip8->program_counter = instruction.addr.nnn;
             break;
-        case 0x3: // SE VX
+        case OP_SE_BYTE:
             if (chip8->registers[instruction.type6.x] == instruction.type6.nn) {
                 chip8->program_counter += 2;
             }
             break;
-        case 0x4: // SNE VX
+        case OP_SNE_BYTE:
             if (chip8->registers[instruction.type6.x] != instruction.type6.nn) {
                 chip8->program_counter += 2;
             }
             break;
-        case 0x5: // SE VX VY
+        case OP_SE_REG:
             if(chip8->registers[instruction.nibbles.x] == chip8->registers[instruction.nibbles.y]) {
                 chip8->program_counter += 2;
             }
             break;
-        case 0x6: // SET VX
+        case OP_LD_BYTE:
             chip8->registers[instruction.type6.x] = instruction.type6.nn;
             break;
-        case 0x7: // ADD VX
+        case OP_ADD_BYTE:
             chip8->registers[instruction.type6.x] += instruction.type6.nn;
             break;
-        case 0x8: // Arithmetic operations
-            switch (instruction.nibbles.n)
-            {
-            case 0x0: // SET VX VY
-                chip8->registers[instruction.nibbles.x] = chip8->registers[instruction.nibbles.y];
-                break;
-            case 0x1: // OR VX VY
-                chip8->registers[instruction.nibbles.x] |= chip8->registers[instruction.nibbles.y];
-                break;
-            case 0x2: // AND VX VY
-                chip8->registers[instruction.nibbles.x] &= chip8->registers[instruction.nibbles.y];
-                break;
-            case 0x3: // XOR VX VY
-                chip8->registers[instruction.nibbles.x] ^= chip8->registers[instruction.nibbles.y];
-                break;
-            case 0x4: // ADD VX VY
-                chip8->registers[0xF] = (chip8->registers[instruction.nibbles.x] + chip8->registers[instruction.nibbles.y]) > 0xFF;
-                chip8->registers[instruction.nibbles.x] += chip8->registers[instruction.nibbles.y];
-                break;
-            case 0x5: // SUB VX VY
-                chip8->registers[0xF] = chip8->registers[instruction.nibbles.x] > chip8->registers[instruction.nibbles.y];
-                chip8->registers[instruction.nibbles.x] -= chip8->registers[instruction.nibbles.y];
-                break;
-            case 0x6: // SHR VX
-                chip8->registers[0xF] = chip8->registers[instruction.nibbles.x] & 0x1;
-                chip8->registers[instruction.nibbles.x] >>= 1;
-                break;
-            case 0x7: // SUBN VX VY
-                chip8->registers[0xF] = chip8->registers[instruction.nibbles.y] > chip8->registers[instruction.nibbles.x];
-                chip8->registers[instruction.nibbles.x] = chip8->registers[instruction.nibbles.y] - chip8->registers[instruction.nibbles.x];
-                break;
-            case 0xE: // SHL VX
-                chip8->registers[0xF] = (chip8->registers[instruction.nibbles.x] & 0x80) >> 7;
-                chip8->registers[instruction.nibbles.x] <<= 1;
-                break;
-            default:
-                break;
-            }
+        case OP_LD_REG:
+            chip8->registers[instruction.nibbles.x] = chip8->registers[instruction.nibbles.y];
+            break;
+        case OP_OR:
+            chip8->registers[instruction.nibbles.x] |= chip8->registers[instruction.nibbles.y];
+            break;
+        case OP_AND:
+            chip8->registers[instruction.nibbles.x] &= chip8->registers[instruction.nibbles.y];
             break;
-        case 0x9: // SNE VX VY
+        case OP_XOR:
+            chip8->registers[instruction.nibbles.x] ^= chip8->registers[instruction.nibbles.y];
+            break;
+        case OP_ADD_REG:
+            chip8->registers[0xF] = (chip8->registers[instruction.nibbles.x] + chip8->registers[instruction.nibbles.y]) > 0xFF;
+            chip8->registers[instruction.nibbles.x] += chip8->registers[instruction.nibbles.y];
+            break;
+        case OP_SUB:
+            chip8->registers[0xF] = chip8->registers[instruction.nibbles.x] > chip8->registers[instruction.nibbles.y];
+            chip8->registers[instruction.nibbles.x] -= chip8->registers[instruction.nibbles.y];
+            break;
+        case OP_SHR:
+            chip8->registers[0xF] = chip8->registers[instruction.nibbles.x] & 0x1;
+            chip8->registers[instruction.nibbles.x] >>= 1;
+            break;
+        case OP_SUBN:
+            chip8->registers[0xF] = chip8->registers[instruction.nibbles.y] > chip8->registers[instruction.nibbles.x];
+            chip8->registers[instruction.nibbles.x] = chip8->registers[instruction.nibbles.y] - chip8->registers[instruction.nibbles.x];
+            break;
+        case OP_SHL:
+            chip8->registers[0xF] = (chip8->registers[instruction.nibbles.x] & 0x80) >> 7;
+            chip8->registers[instruction.nibbles.x] <<= 1;
+            break;
+        case OP_SNE_REG:
             if(chip8->registers[instruction.nibbles.x] != chip8->registers[instruction.nibbles.y]) {
                 chip8->program_counter += 2;
             }
             break;
-        
-        case 0xA: // SET I
+        case OP_LD_I:
             chip8->index = instruction.addr.nnn;
             break;
-        case 0xB: // JMP VX
+        case OP_JP_VX:
             chip8->program_counter = instruction.addr.nnn + chip8->registers[instruction.nibbles.x];
             break;
-        case 0xC: // RND
-            chip8->registers[instruction.type6.x] = (rand() % 256) & instruction.type6.nn;
+        case OP_RND:
+            chip8->registers[instruction.type6.x] = next_random(chip8) & instruction.type6.nn;
+            if (chip8->tracer) {
+                TracerCapture(chip8->tracer, chip8->registers[instruction.type6.x]);
+            }
             break;
-        case 0xE: // Key operations
-            switch (instruction.type6.nn)
-            {
-            case 0x9E: // SKP VX
-                if(chip8->keypad[chip8->registers[instruction.type6.x] & 0xF]) {
-                    chip8->program_counter += 2;
-                }
-                break;
-            case 0xA1: // SKNP VX
-                if(!chip8->keypad[chip8->registers[instruction.type6.x] & 0xF]) {
-                    chip8->program_counter += 2;
-                }
-                break;
-            default:
-                break;
+        case OP_SKP:
+            if(chip8->keypad[chip8->registers[instruction.type6.x] & 0xF]) {
+                chip8->program_counter += 2;
+            }
+            break;
+        case OP_SKNP:
+            if(!chip8->keypad[chip8->registers[instruction.type6.x] & 0xF]) {
+                chip8->program_counter += 2;
             }
             break;
-        case 0xD: { // Draw
+        case OP_DRW: {
             uint8_t x = chip8->registers[instruction.nibbles.x] % 64;
             uint8_t y = chip8->registers[instruction.nibbles.y] % 32;
 
             uint8_t height = instruction.nibbles.n;
             
             chip8->registers[0xF] = 0;
+            if (chip8->debugger) {
+                DebuggerCheckAccess(chip8->debugger, chip8->index, height, WATCH_READ);
+            }
 
             for(uint8_t row = 0; row < height; row++) {
                 uint8_t real_row = (y + row) % 32;
@@ -153,75 +156,108 @@ void ExecuteInstruction(CHIP8 *chip8, Instruction instruction)
             }
 
             chip8->screen_changed = 1;
-
+            if (chip8->tracer) {
+                TracerCapture(chip8->tracer, chip8->registers[0xF]);
+            }
             break;
         }
-        case 0xF:
-            switch (instruction.type6.nn)
-            {
-            case 0x07: // LD VX DT
-                chip8->registers[instruction.type6.x] = chip8->delay_timer;
-                break;
-            case 0x0A: { // LD VX, K
-                int key_found = -1;
-                for (int i = 0; i < 16; i++) {
-                    if (chip8->keypad[i] && !chip8->prev_keypad[i]) {
-                        key_found = i;
-                        break;
-                    }
-                }
-            
-                if (key_found >= 0) {
-                    chip8->registers[instruction.type6.x] = key_found;
-                } else {
-                    chip8->program_counter -= 2; // Wait for key press
-                }
-                break;
+        case OP_LD_VX_DT:
+            chip8->registers[instruction.type6.x] = chip8->delay_timer;
+            if (chip8->tracer) {
+                TracerCapture(chip8->tracer, chip8->registers[instruction.type6.x]);
             }
-            case 0x15: // LD DT, VX
-                chip8->delay_timer = chip8->registers[instruction.type6.x];
-                break;
-            case 0x18: // LD ST, VX
-                chip8->sound_timer = chip8->registers[instruction.type6.x];
-                break;
-            case 0x1E: // ADD I, VX
-                chip8->index += chip8->registers[instruction.type6.x];
-                break;
-            case 0x29: // LD F, VX
-                chip8->index = chip8->registers[instruction.type6.x] * 5; // Font sprite location
-                break;
-            case 0x33: // LD BCD, VX
-                chip8->ram[chip8->index] = chip8->registers[instruction.type6.x] / 100;
-                chip8->ram[chip8->index + 1] = (chip8->registers[instruction.type6.x] / 10) % 10;
-                chip8->ram[chip8->index + 2] = chip8->registers[instruction.type6.x] % 10;
-                break;
-            case 0x55: // LD [I], VX
-                for (int i = 0; i <= instruction.type6.x; i++) {
-                    chip8->ram[chip8->index + i] = chip8->registers[i];
-                }
-                break;
-            case 0x65: // LD VX, [I]
-                for (int i = 0; i <= instruction.type6.x; i++) {
-                    chip8->registers[i] = chip8->ram[chip8->index + i];
+            break;
+        case OP_LD_VX_K: {
+            int key_found = -1;
+            for (int i = 0; i < 16; i++) {
+                if (chip8->keypad[i] && !chip8->prev_keypad[i]) {
+                    key_found = i;
+                    break;
                 }
-                break;
-            
-            default:
-                break;
             }
-        default:
+        
+            if (key_found >= 0) {
+                chip8->registers[instruction.type6.x] = key_found;
+                chip8->prev_keypad[key_found] = 1; // consume the edge so the press registers once per frame
+            } else {
+                chip8->program_counter -= 2; // Wait for key press
+            }
+            if (chip8->tracer) {
+                TracerCapture(chip8->tracer, chip8->registers[instruction.type6.x]);
+            }
+            break;
+        }
+        case OP_LD_DT_VX:
+            chip8->delay_timer = chip8->registers[instruction.type6.x];
+            break;
+        case OP_LD_ST_VX:
+            chip8->sound_timer = chip8->registers[instruction.type6.x];
+            break;
+        case OP_ADD_I_VX:
+            chip8->index += chip8->registers[instruction.type6.x];
+            break;
+        case OP_LD_F_VX:
+            chip8->index = chip8->registers[instruction.type6.x] * 5; // Font sprite location
+            break;
+        case OP_LD_B_VX:
+            if (chip8->debugger) {
+                DebuggerCheckAccess(chip8->debugger, chip8->index, 3, WATCH_WRITE);
+            }
+            if (chip8->fusion) {
+                FusionInvalidate(chip8->fusion, chip8->index, 3);
+            }
+            chip8->ram[chip8->index] = chip8->registers[instruction.type6.x] / 100;
+            chip8->ram[chip8->index + 1] = (chip8->registers[instruction.type6.x] / 10) % 10;
+            chip8->ram[chip8->index + 2] = chip8->registers[instruction.type6.x] % 10;
+            if (chip8->aot) {
+                AotNoteWrite(chip8->aot, chip8->ram, chip8->index, 3);
+            }
+            break;
+        case OP_LD_MEM_VX:
+            if (chip8->debugger) {
+                DebuggerCheckAccess(chip8->debugger, chip8->index, instruction.type6.x + 1, WATCH_WRITE);
+            }
+            if (chip8->fusion) {
+                FusionInvalidate(chip8->fusion, chip8->index, instruction.type6.x + 1);
+            }
+            for (int i = 0; i <= instruction.type6.x; i++) {
+                chip8->ram[chip8->index + i] = chip8->registers[i];
+            }
+            if (chip8->aot) {
+                AotNoteWrite(chip8->aot, chip8->ram, chip8->index, instruction.type6.x + 1);
+            }
+            break;
+        case OP_LD_VX_MEM:
+            if (chip8->debugger) {
+                DebuggerCheckAccess(chip8->debugger, chip8->index, instruction.type6.x + 1, WATCH_READ);
+            }
+            for (int i = 0; i <= instruction.type6.x; i++) {
+                chip8->registers[i] = chip8->ram[chip8->index + i];
+            }
+            if (chip8->tracer) {
+                TracerCaptureRegisters(chip8->tracer, chip8->registers);
+            }
+            break;
+        default: // 0NNN and unassigned words are no-ops
             break;
     }
 }
 
 void InitializeCHIP8(CHIP8 *chip8)
 {
+    InitializeOpcodes();
     chip8->program_counter = CHIP8_ROM_ADDR; // Initialize program counter to start of ROM
     chip8->index = 0x0;
     chip8->stack_pointer = 0;
     chip8->delay_timer = 0;
     chip8->sound_timer = 0;
     chip8->screen_changed = 1;
+    chip8->debug_break = 0;
+    chip8->debugger = NULL;
+    chip8->tracer = NULL;
+    chip8->fusion = NULL;
+    chip8->aot = NULL;
+    SeedRandom(chip8, 0);
     for (int i = 0; i < 16; i++) {
         chip8->registers[i] = 0;
     }
@@ -240,24 +276,102 @@ void InitializeCHIP8(CHIP8 *chip8)
     }
 }
 
-void LoadROM(CHIP8 *chip8, const char *filename)
+bool LoadROMImage(CHIP8 *chip8, const uint8_t *rom, size_t size)
+{
+    if (size > CHIP8_RAM_SIZE - CHIP8_ROM_ADDR) {
+        fprintf(stderr, "ROM too large to fit in memory\n");
+        return false;
+    }
+    memcpy(chip8->ram + CHIP8_ROM_ADDR, rom, size);
+
+    if (chip8->fusion) {
+        FusionScan(chip8->fusion, chip8->ram);
+    }
+    return true;
+}
+
+long LoadROM(CHIP8 *chip8, const char *filename)
 {
     FILE *file = fopen(filename, "rb");
     if (!file) {
         perror("Failed to open ROM file");
-        return;
+        return -1;
+    }
+
+    // one byte more than fits, so oversized files are caught without seeking
+    uint8_t rom[CHIP8_RAM_SIZE - CHIP8_ROM_ADDR + 1];
+    size_t size = fread(rom, 1, sizeof(rom), file);
+    bool failed = ferror(file);
+    fclose(file);
+    if (failed) {
+        perror("Failed to read ROM file");
+        return -1;
     }
+    return LoadROMImage(chip8, rom, size) ? (long)size : -1;
+}
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
 
-    if (file_size > 4096 - CHIP8_ROM_ADDR) {
-        fprintf(stderr, "ROM too large to fit in memory\n");
-        fclose(file);
-        return;
+int RunCycles(CHIP8 *chip8, int cycles)
+{
+    if (chip8->tracer) {
+        return TracerRunCycles(chip8->tracer, chip8, cycles); // runs the debugger's checks too
+    }
+    if (chip8->debugger) {
+        return DebuggerRunCycles(chip8->debugger, cycles); // stops early on a break
+    }
+    if (chip8->aot) {
+        return AotRunCycles(chip8->aot, chip8, cycles);
     }
+    if (chip8->fusion) {
+        return FusionRunCycles(chip8->fusion, chip8, cycles);
+    }
+    for (int i = 0; i < cycles; i++) {
+        Instruction instruction = FetchInstruction(chip8);
+        ExecuteInstruction(chip8, instruction);
+    }
+    return cycles;
+}
 
-    fread(chip8->ram + CHIP8_ROM_ADDR, 1, file_size, file);
-    fclose(file);
+void RecordCycles(CHIP8 *chip8, uint32_t *steps, int cycles)
+{
+    for (int i = 0; i < cycles; i++) {
+        uint32_t pc = chip8->program_counter;
+        Instruction instruction = FetchInstruction(chip8);
+        steps[i] = pc | (uint32_t)instruction.raw << 12;
+        ExecuteInstruction(chip8, instruction);
+    }
+}
+
+void UpdateTimers(CHIP8 *chip8)
+{
+    if (chip8->delay_timer > 0) {
+        chip8->delay_timer--;
+    }
+    if (chip8->sound_timer > 0) {
+        chip8->sound_timer--;
+    }
+}
+
+void UpdateKeypad(CHIP8 *chip8, uint16_t keys)
+{
+    for (int i = 0; i < 16; i++) {
+        chip8->prev_keypad[i] = chip8->keypad[i];
+        chip8->keypad[i] = (keys >> i) & 1;
+    }
+}
+
+void SeedRandom(CHIP8 *chip8, uint32_t seed)
+{
+    chip8->random_state = seed * 2654435761u ^ 0x9E3779B9u; // never zero for small seeds
+    if (chip8->random_state == 0) {
+        chip8->random_state = 1;
+    }
+}
+
+void SetKey(CHIP8 *chip8, int key, bool pressed)
+{
+    chip8->keypad[key & 0xF] = pressed;
+    if (!pressed) {
+        chip8->prev_keypad[key & 0xF] = 0;
+    }
 }
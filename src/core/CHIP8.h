@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include "opcodes.h"
+
 // overridable defaults
 #ifndef CHIP8_ROM_ADDR
 #define CHIP8_ROM_ADDR 0x200
@@ -22,6 +24,11 @@ typedef uint64_t Screen[32]; // 64x32 monochromatic screen
 
 typedef uint16_t Stack[16]; // 16 levels of stack
 
+struct Debugger;
+struct Tracer;
+struct FusionTable;
+struct AotState;
+
 typedef struct _CHIP8 {
     Registers registers;
     Screen screen;
@@ -36,41 +43,38 @@ typedef struct _CHIP8 {
     Keypad prev_keypad;
     // external flags
     uint8_t screen_changed : 1;
-    
+    uint8_t debug_break : 1; // set by the debugger hooks, cleared by the debugger
+    // attached subsystems, NULL when unused
+    struct Debugger *debugger;
+    struct Tracer *tracer;
+    struct FusionTable *fusion; // filled in by LoadROM when set
+    struct AotState *aot;       // compiled code for the loaded ROM
+    uint32_t random_state;      // RND generator; part of the state so copies replay it
 } CHIP8;
 
-typedef union {
-    uint16_t raw;
-
-    struct {
-        uint16_t n : 4;
-        uint16_t y : 4;
-        uint16_t x : 4;
-        uint16_t : 4;
-    } nibbles;
-
-    struct {
-        uint16_t nn : 8;
-        uint16_t x : 4;
-        uint16_t : 4;
-    } type6;
-
-    struct {
-        uint16_t nnn : 12;
-        uint16_t : 4;
-    } addr;
-
-    struct {
-        uint16_t : 12;
-        uint16_t opcode : 4;
-    };
-
-} Instruction;
-
 Instruction FetchInstruction(CHIP8 *chip8);
 void ExecuteInstruction(CHIP8 *chip8, Instruction instruction);
 void InitializeCHIP8(CHIP8 *chip8);
-void LoadROM(CHIP8 *chip8, const char *filename);
+// Both print why and return failure if the ROM is missing or too big.
+// LoadROM returns the ROM size, or -1.
+long LoadROM(CHIP8 *chip8, const char *filename);
+bool LoadROMImage(CHIP8 *chip8, const uint8_t *rom, size_t size);
+// Runs `cycles` instructions back to back and returns how many were executed.
+int RunCycles(CHIP8 *chip8, int cycles);
+// RunCycles without the attached subsystems, storing pc | opcode << 12 for
+// each instruction before it runs. Lives here so the loop inlines the same
+// way the plain one does; the tracer's fast path.
+void RecordCycles(CHIP8 *chip8, uint32_t *steps, int cycles);
+// Decrements the delay and sound timers; call once per 60 Hz frame.
+void UpdateTimers(CHIP8 *chip8);
+// Latches a new keypad state (one bit per key), keeping the previous one for FX0A.
+void UpdateKeypad(CHIP8 *chip8, uint16_t keys);
+// Restarts the RND sequence. InitializeCHIP8 seeds with a fixed value, so
+// two machines given the same ROM and keys stay identical.
+void SeedRandom(CHIP8 *chip8, uint32_t seed);
+// Presses or releases one key between instructions. A release also clears the
+// key's FX0A edge state, so the next press is seen as new.
+void SetKey(CHIP8 *chip8, int key, bool pressed);
 
 
 #endif
\ No newline at end of file
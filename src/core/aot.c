@@ -0,0 +1,80 @@
+#include "aot.h"
+#include <dlfcn.h>
+
+bool AotAttach(AotState *aot, const CompiledROM *rom, CHIP8 *chip8)
+{
+    void *library = aot->library;
+    memset(aot, 0, sizeof(*aot));
+    aot->library = library;
+    if (rom->size > CHIP8_RAM_SIZE - CHIP8_ROM_ADDR ||
+        memcmp(chip8->ram + CHIP8_ROM_ADDR, rom->image, rom->size) != 0) {
+        fprintf(stderr, "Compiled code was generated from a different ROM\n");
+        return false;
+    }
+    aot->rom = rom;
+    chip8->aot = aot;
+    return true;
+}
+
+bool AotLoad(AotState *aot, const char *path, CHIP8 *chip8)
+{
+    memset(aot, 0, sizeof(*aot));
+    aot->library = dlopen(path, RTLD_NOW);
+    if (!aot->library) {
+        fprintf(stderr, "Failed to load compiled ROM: %s\n", dlerror());
+        return false;
+    }
+    const CompiledROM *rom = dlsym(aot->library, AOT_SYMBOL);
+    if (!rom || !AotAttach(aot, rom, chip8)) {
+        if (!rom) fprintf(stderr, "%s: no %s symbol\n", path, AOT_SYMBOL);
+        dlclose(aot->library);
+        aot->library = NULL;
+        return false;
+    }
+    return true;
+}
+
+void AotClose(AotState *aot, CHIP8 *chip8)
+{
+    if (chip8->aot == aot) {
+        chip8->aot = NULL;
+    }
+    if (aot->library) {
+        dlclose(aot->library);
+        aot->library = NULL;
+    }
+    aot->rom = NULL;
+}
+
+void AotNoteWrite(AotState *aot, const uint8_t *ram, uint16_t addr, int length)
+{
+    const CompiledROM *rom = aot->rom;
+    for (int i = 0; i < length; i++) {
+        int offset = addr + i - CHIP8_ROM_ADDR;
+        if (offset < 0 || offset >= rom->size || !rom->code_map[offset]) {
+            continue;
+        }
+        if (ram[addr + i] != rom->image[offset]) {
+            aot->modified = true;
+            aot->invalidated = true;
+        }
+    }
+}
+
+int AotRunCycles(AotState *aot, CHIP8 *chip8, int cycles)
+{
+    int done = aot->rom->run(chip8, aot, cycles);
+    aot->instructions += done;
+    return done;
+}
+
+void AotReport(const AotState *aot, FILE *out)
+{
+    if (!aot->instructions) {
+        return;
+    }
+    fprintf(out, "compiled code: %llu instructions, %.1f%% native%s\n",
+        (unsigned long long)aot->instructions,
+        100.0 * (aot->instructions - aot->interpreted) / aot->instructions,
+        aot->modified ? ", code was modified at run time" : "");
+}
@@ -0,0 +1,49 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "CHIP8.h"
+
+// Runtime side of ch8aot. The generated C file defines one CompiledROM under
+// AOT_SYMBOL; build it as a shared object and load it with AotLoad after
+// LoadROM, and RunCycles runs the native code instead of the interpreter.
+
+#define AOT_SYMBOL "chip8_compiled_rom"
+
+struct AotState;
+
+typedef struct {
+    const uint8_t *image;    // ROM the code was generated from, loaded at CHIP8_ROM_ADDR
+    uint16_t size;
+    const uint8_t *code_map; // 1 for every image byte that belongs to a translated instruction
+    int (*run)(CHIP8 *chip8, struct AotState *aot, int cycles);
+} CompiledROM;
+
+typedef struct AotState {
+    const CompiledROM *rom;
+    void *library;           // dlopen handle, NULL when linked in
+    bool modified;           // translated code was overwritten, blocks verify themselves
+    bool invalidated;        // a write just changed translated code; the generated code bails out
+    uint64_t instructions;   // retired through AotRunCycles
+    uint64_t interpreted;    // of which by the interpreter fallback
+} AotState;
+
+bool AotAttach(AotState *aot, const CompiledROM *rom, CHIP8 *chip8);
+bool AotLoad(AotState *aot, const char *path, CHIP8 *chip8);
+void AotClose(AotState *aot, CHIP8 *chip8);
+// Call after RAM at addr has been written.
+void AotNoteWrite(AotState *aot, const uint8_t *ram, uint16_t addr, int length);
+int AotRunCycles(AotState *aot, CHIP8 *chip8, int cycles);
+void AotReport(const AotState *aot, FILE *out);
+
+// True while the translated block at addr still matches RAM.
+static inline bool AotIntact(const AotState *aot, const CHIP8 *chip8, uint16_t addr, int length)
+{
+    return memcmp(chip8->ram + addr, aot->rom->image + (addr - CHIP8_ROM_ADDR), length) == 0;
+}
+
+#endif
@@ -0,0 +1,594 @@
+#define _GNU_SOURCE // accept4
+#include "debugger.h"
+#include "aot.h"
+#include "fusion.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static bool test_bit(const uint64_t *bitmap, uint16_t addr)
+{
+    addr &= CHIP8_RAM_SIZE - 1;
+    return (bitmap[addr >> 6] >> (addr & 63)) & 1;
+}
+
+// Sets or clears a bit and returns the change in the number of set bits.
+static int change_bit(uint64_t *bitmap, uint16_t addr, bool enabled)
+{
+    addr &= CHIP8_RAM_SIZE - 1;
+    uint64_t mask = 1ull << (addr & 63);
+    bool was_set = bitmap[addr >> 6] & mask;
+    if (enabled) {
+        bitmap[addr >> 6] |= mask;
+    } else {
+        bitmap[addr >> 6] &= ~mask;
+    }
+    return (int)enabled - (int)was_set;
+}
+
+// Attaches the debugger to the core only while something needs checking.
+static void rearm(Debugger *debugger)
+{
+    bool armed = debugger->breakpoint_count > 0 || debugger->watchpoint_count > 0 ||
+                 debugger->stepping || debugger->temp_breakpoint >= 0;
+    debugger->chip8->debugger = armed ? debugger : NULL;
+}
+
+static void halt(Debugger *debugger, StopReason reason)
+{
+    debugger->halted = true;
+    debugger->stepping = false;
+    debugger->temp_breakpoint = -1;
+    debugger->stop_reason = reason;
+    rearm(debugger);
+}
+
+bool DebuggerInit(Debugger *debugger, CHIP8 *chip8, const char *socket_path)
+{
+    memset(debugger, 0, sizeof(*debugger));
+    debugger->chip8 = chip8;
+    debugger->temp_breakpoint = -1;
+    debugger->skip_breakpoint = -1;
+    debugger->listen_fd = -1;
+    debugger->client_fd = -1;
+    chip8->debugger = NULL;
+
+    if (!socket_path) {
+        return true;
+    }
+    if (strlen(socket_path) >= sizeof(debugger->socket_path)) {
+        fprintf(stderr, "Debugger socket path too long: %s\n", socket_path);
+        return false;
+    }
+    strcpy(debugger->socket_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Failed to create debugger socket");
+        return false;
+    }
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, socket_path);
+    // clear a stale socket from an earlier run, but nothing else
+    struct stat st;
+    if (lstat(socket_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "Debugger socket path exists and is not a socket: %s\n", socket_path);
+            close(fd);
+            return false;
+        }
+        unlink(socket_path);
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        perror("Failed to bind debugger socket");
+        close(fd);
+        return false;
+    }
+    debugger->listen_fd = fd;
+    return true;
+}
+
+void DebuggerClose(Debugger *debugger)
+{
+    if (debugger->client_fd >= 0) {
+        close(debugger->client_fd);
+    }
+    if (debugger->listen_fd >= 0) {
+        close(debugger->listen_fd);
+        unlink(debugger->socket_path);
+    }
+    debugger->client_fd = -1;
+    debugger->listen_fd = -1;
+    debugger->chip8->debugger = NULL;
+}
+
+void DebuggerSetBreakpoint(Debugger *debugger, uint16_t addr, bool enabled)
+{
+    debugger->breakpoint_count += change_bit(debugger->breakpoints, addr, enabled);
+    rearm(debugger);
+}
+
+void DebuggerSetWatchpoint(Debugger *debugger, uint16_t addr, int length, WatchType type, bool enabled)
+{
+    for (int i = 0; i < length; i++) {
+        if (type & WATCH_READ) {
+            debugger->watchpoint_count += change_bit(debugger->read_watch, addr + i, enabled);
+        }
+        if (type & WATCH_WRITE) {
+            debugger->watchpoint_count += change_bit(debugger->write_watch, addr + i, enabled);
+        }
+    }
+    rearm(debugger);
+}
+
+void DebuggerContinue(Debugger *debugger)
+{
+    debugger->halted = false;
+    debugger->stop_reason = STOP_NONE;
+    debugger->skip_breakpoint = debugger->chip8->program_counter;
+    rearm(debugger);
+}
+
+void DebuggerStep(Debugger *debugger)
+{
+    debugger->stepping = true;
+    DebuggerContinue(debugger);
+}
+
+void DebuggerStepOver(Debugger *debugger)
+{
+    CHIP8 *chip8 = debugger->chip8;
+    uint16_t pc = chip8->program_counter;
+    uint16_t opcode = chip8->ram[pc & (CHIP8_RAM_SIZE - 1)] << 8 | chip8->ram[(pc + 1) & (CHIP8_RAM_SIZE - 1)];
+    if (DecodeOpcode(opcode) == OP_CALL) {
+        debugger->temp_breakpoint = (pc + 2) & (CHIP8_RAM_SIZE - 1);
+        DebuggerContinue(debugger);
+    } else {
+        DebuggerStep(debugger);
+    }
+}
+
+bool DebuggerCheckFetch(Debugger *debugger, uint16_t addr)
+{
+    if (debugger->skip_breakpoint == addr) {
+        debugger->skip_breakpoint = -1;
+        return false;
+    }
+    debugger->skip_breakpoint = -1;
+    if (test_bit(debugger->breakpoints, addr) || debugger->temp_breakpoint == addr) {
+        debugger->stop_reason = STOP_BREAKPOINT;
+        debugger->chip8->debug_break = 1;
+        return true;
+    }
+    return false;
+}
+
+void DebuggerCheckAccess(Debugger *debugger, uint16_t addr, int length, WatchType type)
+{
+    const uint64_t *bitmap = type == WATCH_WRITE ? debugger->write_watch : debugger->read_watch;
+    for (int i = 0; i < length; i++) {
+        if (test_bit(bitmap, addr + i)) {
+            debugger->stop_reason = type == WATCH_WRITE ? STOP_WATCH_WRITE : STOP_WATCH_READ;
+            debugger->stop_addr = (addr + i) & (CHIP8_RAM_SIZE - 1);
+            debugger->chip8->debug_break = 1;
+            return;
+        }
+    }
+}
+
+bool DebuggerExecuted(Debugger *debugger)
+{
+    if (debugger->stepping) {
+        if (debugger->stop_reason != STOP_INTERRUPT) {
+            debugger->stop_reason = STOP_STEP;
+        }
+        debugger->chip8->debug_break = 1;
+    }
+    return debugger->chip8->debug_break;
+}
+
+int DebuggerRunCycles(Debugger *debugger, int cycles)
+{
+    CHIP8 *chip8 = debugger->chip8;
+    for (int i = 0; i < cycles; i++) {
+        Instruction instruction = FetchInstruction(chip8);
+        if (chip8->debug_break) {
+            return i;
+        }
+        ExecuteInstruction(chip8, instruction);
+        if (DebuggerExecuted(debugger)) {
+            return i + 1;
+        }
+    }
+    return cycles;
+}
+
+// --- remote stub -----------------------------------------------------------
+//
+// A subset of the GDB remote serial protocol: $packet#checksum framing, '+'
+// acks and ^C interrupts. Register order for g/p/P is V0-VF, I, PC, SP, DT, ST.
+// Extensions: qC8.stack returns SP followed by the 16 stack entries,
+// QC8.stack:<same format> replaces them, and vC8.next steps over a CALL.
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static void detach(Debugger *debugger);
+
+#define SEND_TIMEOUT_MS 1000 // a client that reads nothing for this long is dropped
+
+// The socket is non-blocking, so a large reply can go out in pieces; wait
+// for room rather than drop the rest and desynchronise the protocol.
+static void send_all(Debugger *debugger, const char *data, size_t len)
+{
+    while (len > 0 && debugger->client_fd >= 0) {
+        ssize_t sent = send(debugger->client_fd, data, len, MSG_NOSIGNAL);
+        if (sent > 0) {
+            data += sent;
+            len -= sent;
+            continue;
+        }
+        struct pollfd writable = { .fd = debugger->client_fd, .events = POLLOUT };
+        if ((sent < 0 && errno != EAGAIN && errno != EINTR) ||
+            (sent < 0 && errno == EAGAIN && poll(&writable, 1, SEND_TIMEOUT_MS) <= 0)) {
+            detach(debugger); // also resumes the emulator if it was halted
+        }
+    }
+}
+
+static void send_packet(Debugger *debugger, const char *payload)
+{
+    if (debugger->client_fd < 0) {
+        return;
+    }
+    char packet[DEBUGGER_PACKET_SIZE * 2 + 8];
+    size_t len = strlen(payload);
+    uint8_t checksum = 0;
+    for (size_t i = 0; i < len; i++) {
+        checksum += (uint8_t)payload[i];
+    }
+    int n = snprintf(packet, sizeof(packet), "$%s#%02x", payload, checksum);
+    send_all(debugger, packet, n);
+}
+
+static void send_stop_reply(Debugger *debugger)
+{
+    char reply[32];
+    switch (debugger->stop_reason) {
+        case STOP_INTERRUPT:
+        case STOP_ATTACH:
+            strcpy(reply, "S02");
+            break;
+        case STOP_WATCH_READ:
+            snprintf(reply, sizeof(reply), "T05rwatch:%x;", debugger->stop_addr);
+            break;
+        case STOP_WATCH_WRITE:
+            snprintf(reply, sizeof(reply), "T05watch:%x;", debugger->stop_addr);
+            break;
+        default:
+            strcpy(reply, "S05");
+            break;
+    }
+    send_packet(debugger, reply);
+}
+
+void DebuggerStop(Debugger *debugger)
+{
+    debugger->chip8->debug_break = 0;
+    halt(debugger, debugger->stop_reason);
+    if (debugger->reply_on_stop) {
+        debugger->reply_on_stop = false;
+        send_stop_reply(debugger);
+    }
+}
+
+static void detach(Debugger *debugger)
+{
+    memset(debugger->breakpoints, 0, sizeof(debugger->breakpoints));
+    memset(debugger->read_watch, 0, sizeof(debugger->read_watch));
+    memset(debugger->write_watch, 0, sizeof(debugger->write_watch));
+    debugger->breakpoint_count = 0;
+    debugger->watchpoint_count = 0;
+    debugger->stepping = false;
+    debugger->temp_breakpoint = -1;
+    debugger->reply_on_stop = false;
+    DebuggerContinue(debugger);
+    if (debugger->client_fd >= 0) {
+        close(debugger->client_fd);
+        debugger->client_fd = -1;
+    }
+}
+
+static char *put_hex(char *out, const uint8_t *bytes, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        *out++ = hex_digits[bytes[i] >> 4];
+        *out++ = hex_digits[bytes[i] & 0xF];
+    }
+    *out = '\0';
+    return out;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decodes 2 * len hex digits into `out`, leaving it untouched unless all of
+// them are valid.
+static bool decode_hex(const char *hex, uint8_t *out, size_t len)
+{
+    for (size_t i = 0; i < 2 * len; i++) {
+        if (hex_value(hex[i]) < 0) return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        out[i] = hex_value(hex[2 * i]) << 4 | hex_value(hex[2 * i + 1]);
+    }
+    return true;
+}
+
+// Serializes one register in target (little endian) byte order.
+static int read_register(CHIP8 *chip8, int reg, uint8_t *out)
+{
+    if (reg >= 0 && reg < 16) {
+        out[0] = chip8->registers[reg];
+        return 1;
+    }
+    switch (reg) {
+        case 16: out[0] = chip8->index & 0xFF; out[1] = chip8->index >> 8; return 2;
+        case 17: out[0] = chip8->program_counter & 0xFF; out[1] = chip8->program_counter >> 8; return 2;
+        case 18: out[0] = chip8->stack_pointer; return 1;
+        case 19: out[0] = chip8->delay_timer; return 1;
+        case 20: out[0] = chip8->sound_timer; return 1;
+        default: return 0;
+    }
+}
+
+static bool write_register(CHIP8 *chip8, int reg, unsigned long value)
+{
+    if (reg >= 0 && reg < 16) {
+        chip8->registers[reg] = value;
+        return true;
+    }
+    switch (reg) {
+        case 16: chip8->index = value; return true;
+        case 17: chip8->program_counter = value; return true;
+        case 18: chip8->stack_pointer = value; return true;
+        case 19: chip8->delay_timer = value; return true;
+        case 20: chip8->sound_timer = value; return true;
+        default: return false;
+    }
+}
+
+static bool parse_range(const char *args, unsigned long *addr, unsigned long *len, const char **end)
+{
+    char *next;
+    *addr = strtoul(args, &next, 16);
+    if (*next != ',') return false;
+    *len = strtoul(next + 1, &next, 16);
+    if (end) *end = next;
+    return *addr < CHIP8_RAM_SIZE && *len <= CHIP8_RAM_SIZE - *addr;
+}
+
+static void handle_packet(Debugger *debugger, char *packet)
+{
+    CHIP8 *chip8 = debugger->chip8;
+    char reply[DEBUGGER_PACKET_SIZE * 2 + 1] = "";
+    unsigned long addr, len;
+    const char *end;
+
+    switch (packet[0]) {
+        case '?':
+            send_stop_reply(debugger);
+            return;
+        case 'g': {
+            char *out = reply;
+            for (int reg = 0; reg <= 20; reg++) {
+                uint8_t bytes[2];
+                out = put_hex(out, bytes, read_register(chip8, reg, bytes));
+            }
+            break;
+        }
+        case 'p': {
+            uint8_t bytes[2];
+            int n = read_register(chip8, (int)strtol(packet + 1, NULL, 16), bytes);
+            if (n) put_hex(reply, bytes, n);
+            else strcpy(reply, "E01");
+            break;
+        }
+        case 'P': {
+            char *value;
+            int reg = (int)strtol(packet + 1, &value, 16);
+            // exactly the register's width, in target (little endian) byte order
+            uint8_t bytes[2] = { 0 };
+            int width = read_register(chip8, reg, bytes);
+            bool valid = width && *value == '=' && strlen(value + 1) == 2 * (size_t)width &&
+                         decode_hex(value + 1, bytes, width);
+            strcpy(reply, valid && write_register(chip8, reg, bytes[0] | bytes[1] << 8) ? "OK" : "E01");
+            break;
+        }
+        case 'm':
+            if (parse_range(packet + 1, &addr, &len, NULL) && len <= DEBUGGER_PACKET_SIZE) {
+                put_hex(reply, chip8->ram + addr, len);
+            } else {
+                strcpy(reply, "E01");
+            }
+            break;
+        case 'M':
+            if (parse_range(packet + 1, &addr, &len, &end) && *end == ':' && strlen(end + 1) >= 2 * len &&
+                decode_hex(end + 1, chip8->ram + addr, len)) {
+                if (chip8->fusion) {
+                    FusionInvalidate(chip8->fusion, addr, len);
+                }
+                if (chip8->aot) {
+                    AotNoteWrite(chip8->aot, chip8->ram, addr, len);
+                }
+                strcpy(reply, "OK");
+            } else {
+                strcpy(reply, "E01");
+            }
+            break;
+        case 'Z':
+        case 'z': {
+            bool enabled = packet[0] == 'Z';
+            char type = packet[1];
+            if (packet[2] != ',' || !parse_range(packet + 3, &addr, &len, NULL)) {
+                strcpy(reply, "E01");
+                break;
+            }
+            if (type == '0' || type == '1') {
+                DebuggerSetBreakpoint(debugger, addr, enabled);
+            } else if (type >= '2' && type <= '4') {
+                static const WatchType types[] = { WATCH_WRITE, WATCH_READ, WATCH_ACCESS };
+                DebuggerSetWatchpoint(debugger, addr, len ? len : 1, types[type - '2'], enabled);
+            } else {
+                break; // unsupported type: empty reply
+            }
+            strcpy(reply, "OK");
+            break;
+        }
+        case 'c':
+            debugger->reply_on_stop = true;
+            DebuggerContinue(debugger);
+            return;
+        case 's':
+            debugger->reply_on_stop = true;
+            DebuggerStep(debugger);
+            return;
+        case 'D':
+            send_packet(debugger, "OK");
+            detach(debugger);
+            return;
+        case 'k':
+            detach(debugger);
+            return;
+        case 'H':
+            strcpy(reply, "OK");
+            break;
+        case 'q':
+            if (strncmp(packet, "qSupported", 10) == 0) {
+                snprintf(reply, sizeof(reply), "PacketSize=%x", DEBUGGER_PACKET_SIZE);
+            } else if (strcmp(packet, "qAttached") == 0) {
+                strcpy(reply, "1");
+            } else if (strcmp(packet, "qC8.stack") == 0) {
+                uint8_t bytes[1 + sizeof(Stack)];
+                bytes[0] = chip8->stack_pointer;
+                for (int i = 0; i < 16; i++) {
+                    bytes[1 + 2 * i] = chip8->stack[i] & 0xFF;
+                    bytes[2 + 2 * i] = chip8->stack[i] >> 8;
+                }
+                put_hex(reply, bytes, sizeof(bytes));
+            }
+            break;
+        case 'Q':
+            if (strncmp(packet, "QC8.stack:", 10) == 0) {
+                uint8_t bytes[1 + sizeof(Stack)];
+                if (strlen(packet + 10) < 2 * sizeof(bytes) || !decode_hex(packet + 10, bytes, sizeof(bytes))) {
+                    strcpy(reply, "E01");
+                    break;
+                }
+                chip8->stack_pointer = bytes[0];
+                for (int i = 0; i < 16; i++) {
+                    chip8->stack[i] = bytes[1 + 2 * i] | bytes[2 + 2 * i] << 8;
+                }
+                strcpy(reply, "OK");
+            }
+            break;
+        case 'v':
+            if (strcmp(packet, "vC8.next") == 0) {
+                debugger->reply_on_stop = true;
+                DebuggerStepOver(debugger);
+                return;
+            }
+            break;
+        default:
+            break; // unsupported: empty reply
+    }
+    send_packet(debugger, reply);
+}
+
+// Extracts complete packets from the input buffer.
+static void process_input(Debugger *debugger)
+{
+    size_t pos = 0;
+    while (pos < debugger->input_len) {
+        char c = debugger->input[pos];
+        if (c == 0x03) { // ^C
+            if (!debugger->halted) {
+                debugger->stepping = true;
+                debugger->stop_reason = STOP_INTERRUPT;
+                rearm(debugger);
+            }
+            pos++;
+            continue;
+        }
+        if (c != '$') { // acks and noise
+            pos++;
+            continue;
+        }
+        char *hash = memchr(debugger->input + pos, '#', debugger->input_len - pos);
+        if (!hash || hash + 2 >= debugger->input + debugger->input_len) {
+            break; // incomplete
+        }
+        *hash = '\0';
+        send_all(debugger, "+", 1);
+        handle_packet(debugger, debugger->input + pos + 1);
+        if (debugger->client_fd < 0) {
+            debugger->input_len = 0;
+            return;
+        }
+        pos = hash + 3 - debugger->input;
+    }
+    memmove(debugger->input, debugger->input + pos, debugger->input_len - pos);
+    debugger->input_len -= pos;
+    if (debugger->input_len == sizeof(debugger->input)) {
+        debugger->input_len = 0; // oversized packet, drop it
+    }
+}
+
+void DebuggerPoll(Debugger *debugger, int timeout_ms)
+{
+    if (debugger->listen_fd < 0) {
+        return;
+    }
+    struct pollfd fds[2] = {
+        { .fd = debugger->listen_fd, .events = POLLIN },
+        { .fd = debugger->client_fd, .events = POLLIN },
+    };
+    if (poll(fds, debugger->client_fd >= 0 ? 2 : 1, timeout_ms) <= 0) {
+        return;
+    }
+
+    if (fds[0].revents & POLLIN) {
+        int fd = accept4(debugger->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0 && debugger->client_fd >= 0) {
+            close(fd); // one client at a time
+        } else if (fd >= 0) {
+            debugger->client_fd = fd;
+            debugger->input_len = 0;
+            halt(debugger, STOP_ATTACH);
+        }
+    }
+
+    if (debugger->client_fd >= 0 && fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+        ssize_t n = recv(debugger->client_fd, debugger->input + debugger->input_len,
+                         sizeof(debugger->input) - debugger->input_len, 0);
+        if (n <= 0 && !(n < 0 && errno == EAGAIN)) {
+            detach(debugger);
+            return;
+        }
+        if (n > 0) {
+            debugger->input_len += n;
+            process_input(debugger);
+        }
+    }
+}
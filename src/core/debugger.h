@@ -0,0 +1,77 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "CHIP8.h"
+
+#define DEBUGGER_BITMAP_WORDS (CHIP8_RAM_SIZE / 64)
+#define DEBUGGER_PACKET_SIZE 4096
+
+typedef enum {
+    STOP_NONE = 0,
+    STOP_ATTACH,
+    STOP_INTERRUPT,
+    STOP_STEP,
+    STOP_BREAKPOINT,
+    STOP_WATCH_READ,
+    STOP_WATCH_WRITE,
+} StopReason;
+
+typedef enum {
+    WATCH_WRITE = 1,
+    WATCH_READ = 2,
+    WATCH_ACCESS = WATCH_READ | WATCH_WRITE,
+} WatchType;
+
+// One bit per RAM address. The core only looks at these through
+// `chip8->debugger`, which is NULL unless something is armed, so an idle
+// debugger costs a single branch per fetch.
+typedef struct Debugger {
+    uint64_t breakpoints[DEBUGGER_BITMAP_WORDS];
+    uint64_t read_watch[DEBUGGER_BITMAP_WORDS];
+    uint64_t write_watch[DEBUGGER_BITMAP_WORDS];
+    int breakpoint_count;
+    int watchpoint_count;
+    CHIP8 *chip8;
+
+    // run control
+    bool halted;
+    bool stepping;           // stop after the next instruction
+    int temp_breakpoint;     // step-over return address, -1 if unused
+    int skip_breakpoint;     // address resumed from, ignored once, -1 if unused
+    StopReason stop_reason;
+    uint16_t stop_addr;      // watchpoint address of the last stop
+
+    // remote stub
+    int listen_fd;
+    int client_fd;
+    bool reply_on_stop;      // the client is waiting for a stop reply
+    char socket_path[108];
+    char input[DEBUGGER_PACKET_SIZE];
+    size_t input_len;
+} Debugger;
+
+bool DebuggerInit(Debugger *debugger, CHIP8 *chip8, const char *socket_path);
+void DebuggerClose(Debugger *debugger);
+// Services the remote stub; waits up to `timeout_ms` for activity (0 = poll).
+void DebuggerPoll(Debugger *debugger, int timeout_ms);
+// Called when the core has raised `debug_break`; halts and notifies the client.
+void DebuggerStop(Debugger *debugger);
+
+void DebuggerSetBreakpoint(Debugger *debugger, uint16_t addr, bool enabled);
+void DebuggerSetWatchpoint(Debugger *debugger, uint16_t addr, int length, WatchType type, bool enabled);
+void DebuggerContinue(Debugger *debugger);
+void DebuggerStep(Debugger *debugger);
+void DebuggerStepOver(Debugger *debugger);
+
+// Execution hooks used by the core while a debugger is armed.
+int DebuggerRunCycles(Debugger *debugger, int cycles);
+bool DebuggerCheckFetch(Debugger *debugger, uint16_t addr);
+// After each executed instruction: true when the run has to stop there.
+bool DebuggerExecuted(Debugger *debugger);
+void DebuggerCheckAccess(Debugger *debugger, uint16_t addr, int length, WatchType type);
+
+#endif
@@ -0,0 +1,37 @@
+#include "framebuffer.h"
+#include <string.h>
+
+void TripleBufferInit(TripleBuffer *buffer)
+{
+    memset(buffer->slots, 0, sizeof(buffer->slots));
+    buffer->back = 0;
+    atomic_store(&buffer->middle, 1);
+    buffer->front = 2;
+}
+
+uint64_t *TripleBufferBack(TripleBuffer *buffer)
+{
+    return buffer->slots[buffer->back];
+}
+
+bool TripleBufferPublish(TripleBuffer *buffer)
+{
+    uint_fast8_t previous = atomic_exchange_explicit(&buffer->middle, buffer->back | FRAMEBUFFER_FRESH, memory_order_acq_rel);
+    buffer->back = previous & ~FRAMEBUFFER_FRESH;
+    return previous & FRAMEBUFFER_FRESH;
+}
+
+bool TripleBufferAcquire(TripleBuffer *buffer)
+{
+    if (!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) & FRAMEBUFFER_FRESH)) {
+        return false;
+    }
+    uint_fast8_t previous = atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel);
+    buffer->front = previous & ~FRAMEBUFFER_FRESH;
+    return true;
+}
+
+const uint64_t *TripleBufferFront(const TripleBuffer *buffer)
+{
+    return buffer->slots[buffer->front];
+}
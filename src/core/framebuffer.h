@@ -0,0 +1,31 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "CHIP8.h"
+
+// Lock-free single-producer/single-consumer triple buffer for completed frames.
+// The producer always owns `back`, the consumer always owns `front`, and the
+// two swap slots through `middle` so neither side ever waits on the other.
+typedef struct {
+    Screen slots[3];
+    atomic_uint_fast8_t middle; // slot index | FRAMEBUFFER_FRESH
+    uint8_t back;
+    uint8_t front;
+} TripleBuffer;
+
+#define FRAMEBUFFER_FRESH 0x4
+
+void TripleBufferInit(TripleBuffer *buffer);
+// Slot the producer may write the next frame into.
+uint64_t *TripleBufferBack(TripleBuffer *buffer);
+// Returns true if the frame it replaces was never acquired, i.e. was dropped.
+bool TripleBufferPublish(TripleBuffer *buffer);
+// Returns true and swaps in the newest frame if one was published since the last call.
+bool TripleBufferAcquire(TripleBuffer *buffer);
+const uint64_t *TripleBufferFront(const TripleBuffer *buffer);
+
+#endif
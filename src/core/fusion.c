@@ -0,0 +1,155 @@
+#include "fusion.h"
+#include <string.h>
+
+static const char *kind_names[FUSE_KINDS] = {
+    [FUSE_SPRITE] = "sprite draw (ANNN DXYN)",
+    [FUSE_COUNTED_LOOP] = "counted loop (7XNN 3XNN 1NNN)",
+    [FUSE_TIMER_WAIT] = "timer wait (FX07 3X00 1NNN)",
+    [FUSE_TABLE_LOAD] = "table load (ANNN FX65)",
+};
+
+static uint16_t opcode_at(const uint8_t *ram, uint16_t addr)
+{
+    return ram[addr & (CHIP8_RAM_SIZE - 1)] << 8 | ram[(addr + 1) & (CHIP8_RAM_SIZE - 1)];
+}
+
+static FusionKind match(const uint8_t *ram, uint16_t addr)
+{
+    uint16_t a = opcode_at(ram, addr);
+    uint16_t b = opcode_at(ram, addr + 2);
+    uint16_t c = opcode_at(ram, addr + 4);
+
+    Opcode first = DecodeOpcode(a), second = DecodeOpcode(b), third = DecodeOpcode(c);
+
+    if (first == OP_LD_I && second == OP_DRW) {
+        return FUSE_SPRITE;
+    }
+    if (first == OP_LD_I && second == OP_LD_VX_MEM) {
+        return FUSE_TABLE_LOAD;
+    }
+    if (first == OP_ADD_BYTE && second == OP_SE_BYTE && (a & 0x0F00) == (b & 0x0F00) && third == OP_JP) {
+        return FUSE_COUNTED_LOOP;
+    }
+    if (first == OP_LD_VX_DT && b == (0x3000 | (a & 0x0F00)) && c == (0x1000 | addr)) {
+        return FUSE_TIMER_WAIT;
+    }
+    return FUSE_NONE;
+}
+
+void FusionScan(FusionTable *fusion, const uint8_t *ram)
+{
+    memset(fusion, 0, sizeof(*fusion));
+    InitializeOpcodes();
+    // any byte can be a jump target, so try every address
+    for (int addr = CHIP8_ROM_ADDR; addr + 4 <= CHIP8_RAM_SIZE; addr++) {
+        fusion->kind[addr] = match(ram, addr);
+        fusion->sites[fusion->kind[addr]]++;
+    }
+}
+
+void FusionInvalidate(FusionTable *fusion, uint16_t addr, int length)
+{
+    // a pattern starting up to 5 bytes earlier may cover the written range
+    for (int a = addr - 5; a < addr + length; a++) {
+        if (a >= 0 && a < CHIP8_RAM_SIZE) {
+            fusion->kind[a] = FUSE_NONE;
+        }
+    }
+}
+
+// Runs the sequence at PC as one step. Returns the number of instructions
+// retired, which never exceeds `budget`, or 0 to fall back to the interpreter.
+static int execute_fused(FusionKind kind, CHIP8 *chip8, int budget)
+{
+    uint16_t pc = chip8->program_counter;
+    Instruction first = { .raw = opcode_at(chip8->ram, pc) };
+    Instruction second = { .raw = opcode_at(chip8->ram, pc + 2) };
+
+    switch (kind) {
+        case FUSE_SPRITE:
+        case FUSE_TABLE_LOAD:
+            if (budget < 2) return 0;
+            chip8->index = first.addr.nnn;
+            chip8->program_counter = pc + 4;
+            ExecuteInstruction(chip8, second);
+            return 2;
+        case FUSE_COUNTED_LOOP: {
+            if (budget < 3) return 0;
+            uint16_t target = opcode_at(chip8->ram, pc + 4) & 0x0FFF;
+            uint8_t *vx = &chip8->registers[first.type6.x];
+            if (target != pc) {
+                *vx += first.type6.nn;
+                if (*vx == second.type6.nn) {
+                    chip8->program_counter = pc + 6;
+                    return 2;
+                }
+                chip8->program_counter = target;
+                return 3;
+            }
+            // tight delay loop: spin whole iterations without leaving C
+            int used = 0;
+            while (budget - used >= 3) {
+                *vx += first.type6.nn;
+                if (*vx == second.type6.nn) {
+                    chip8->program_counter = pc + 6;
+                    return used + 2;
+                }
+                used += 3;
+            }
+            chip8->program_counter = pc;
+            return used;
+        }
+        case FUSE_TIMER_WAIT:
+            if (budget < 3) return 0;
+            chip8->registers[first.type6.x] = chip8->delay_timer;
+            if (chip8->delay_timer == 0) {
+                chip8->program_counter = pc + 6; // the skip retires FX07 and 3X00 only
+                return 2;
+            }
+            // the delay timer only changes between frames, so the rest of
+            // this frame's whole iterations would all see the same value
+            chip8->program_counter = pc;
+            return budget - budget % 3;
+        default:
+            return 0;
+    }
+}
+
+int FusionRunCycles(FusionTable *fusion, CHIP8 *chip8, int cycles)
+{
+    int done = 0;
+    while (done < cycles) {
+        FusionKind kind = fusion->kind[chip8->program_counter];
+        if (kind) {
+            int retired = execute_fused(kind, chip8, cycles - done);
+            if (retired) {
+                fusion->dispatches[kind]++;
+                fusion->fused[kind] += retired;
+                done += retired;
+                continue;
+            }
+        }
+        Instruction instruction = FetchInstruction(chip8);
+        ExecuteInstruction(chip8, instruction);
+        done++;
+    }
+    fusion->instructions += done;
+    return done;
+}
+
+void FusionReport(const FusionTable *fusion, FILE *out)
+{
+    if (fusion->instructions == 0) {
+        return;
+    }
+    uint64_t fused = 0;
+    for (int kind = 1; kind < FUSE_KINDS; kind++) {
+        fused += fusion->fused[kind];
+    }
+    fprintf(out, "fusion: %.1f%% of %llu instructions ran fused\n",
+        100.0 * fused / fusion->instructions, (unsigned long long)fusion->instructions);
+    for (int kind = 1; kind < FUSE_KINDS; kind++) {
+        fprintf(out, "  %-32s %4u sites %10llu hits %6.1f%%\n", kind_names[kind], fusion->sites[kind],
+            (unsigned long long)fusion->dispatches[kind], 100.0 * fusion->fused[kind] / fusion->instructions);
+    }
+}
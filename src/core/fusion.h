@@ -0,0 +1,34 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "CHIP8.h"
+
+typedef enum {
+    FUSE_NONE = 0,
+    FUSE_SPRITE,       // ANNN DXYN
+    FUSE_COUNTED_LOOP, // 7XNN 3XNN 1NNN
+    FUSE_TIMER_WAIT,   // FX07 3X00 1NNN back to the FX07
+    FUSE_TABLE_LOAD,   // ANNN FX65
+    FUSE_KINDS,
+} FusionKind;
+
+// Superinstructions found by scanning RAM at LoadROM time, keyed by the
+// address of their first instruction. A jump into the middle of a sequence
+// simply finds no entry there, and writes to RAM drop the entries they touch.
+typedef struct FusionTable {
+    uint8_t kind[CHIP8_RAM_SIZE];
+    uint32_t sites[FUSE_KINDS];        // patterns found by the scan
+    uint64_t dispatches[FUSE_KINDS];
+    uint64_t fused[FUSE_KINDS];        // instructions retired through fused handlers
+    uint64_t instructions;             // all instructions retired
+} FusionTable;
+
+void FusionScan(FusionTable *fusion, const uint8_t *ram);
+void FusionInvalidate(FusionTable *fusion, uint16_t addr, int length);
+int FusionRunCycles(FusionTable *fusion, CHIP8 *chip8, int cycles);
+void FusionReport(const FusionTable *fusion, FILE *out);
+
+#endif
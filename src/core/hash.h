@@ -0,0 +1,20 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 64-bit FNV-1a. Start from HASH_SEED and feed the bytes through HashBytes,
+// in as many pieces as convenient; the result is the same either way.
+#define HASH_SEED 0xCBF29CE484222325ULL
+
+static inline uint64_t HashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+#endif
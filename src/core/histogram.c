@@ -0,0 +1,60 @@
+#include "histogram.h"
+#include <stdio.h>
+
+void HistogramRecord(FrameHistogram *histogram, uint64_t ns)
+{
+    uint64_t bucket = ns / HISTOGRAM_BUCKET_NS;
+    if (bucket >= HISTOGRAM_BUCKETS) {
+        bucket = HISTOGRAM_BUCKETS - 1;
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->total_ns += ns;
+    if (ns > histogram->max_ns) {
+        histogram->max_ns = ns;
+    }
+}
+
+uint64_t HistogramPercentile(const FrameHistogram *histogram, double percentile)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(histogram->count * percentile);
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > target) {
+            return (uint64_t)(i + 1) * HISTOGRAM_BUCKET_NS; // upper bound of the bucket
+        }
+    }
+    return histogram->max_ns;
+}
+
+void HistogramPrint(const FrameHistogram *histogram, const char *name)
+{
+    if (histogram->count == 0) {
+        return;
+    }
+    fprintf(stderr, "%s frame time: %llu frames, mean %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+        name,
+        (unsigned long long)histogram->count,
+        histogram->total_ns / 1e6 / histogram->count,
+        HistogramPercentile(histogram, 0.50) / 1e6,
+        HistogramPercentile(histogram, 0.99) / 1e6,
+        histogram->max_ns / 1e6);
+
+    uint32_t peak = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (histogram->buckets[i] > peak) peak = histogram->buckets[i];
+    }
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (!histogram->buckets[i]) continue;
+        int width = (int)((uint64_t)histogram->buckets[i] * 40 / peak);
+        fprintf(stderr, "  %6.2f ms%s | %-40.*s %u\n",
+            (double)i * HISTOGRAM_BUCKET_NS / 1e6,
+            i == HISTOGRAM_BUCKETS - 1 ? "+" : " ",
+            width > 0 ? width : 1, "########################################",
+            histogram->buckets[i]);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HISTOGRAM_BUCKETS 256
+#define HISTOGRAM_BUCKET_NS 250000 // 0.25 ms per bucket
+
+// Fixed-width frame-time histogram; the last bucket collects everything slower.
+typedef struct {
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} FrameHistogram;
+
+void HistogramRecord(FrameHistogram *histogram, uint64_t ns);
+uint64_t HistogramPercentile(const FrameHistogram *histogram, double percentile);
+void HistogramPrint(const FrameHistogram *histogram, const char *name);
+
+#endif
@@ -0,0 +1,150 @@
+#include "input.h"
+#include <stdlib.h>
+
+void InputQueueInit(InputQueue *queue)
+{
+    atomic_store(&queue->head, 0);
+    atomic_store(&queue->tail, 0);
+}
+
+bool InputQueuePush(InputQueue *queue, InputEvent event)
+{
+    unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head - tail == INPUT_QUEUE_SIZE) {
+        return false;
+    }
+    queue->events[head & (INPUT_QUEUE_SIZE - 1)] = event;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool InputQueuePeek(InputQueue *queue, InputEvent *event)
+{
+    unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&queue->head, memory_order_acquire) == tail) {
+        return false;
+    }
+    *event = queue->events[tail & (INPUT_QUEUE_SIZE - 1)];
+    return true;
+}
+
+void InputQueuePop(InputQueue *queue)
+{
+    unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+}
+
+int InputEventCycle(uint64_t time_ns, uint64_t window_start, uint64_t window_end, int cycles)
+{
+    if (time_ns <= window_start || window_end <= window_start || cycles <= 0) {
+        return 0;
+    }
+    if (time_ns >= window_end) {
+        return cycles - 1;
+    }
+    return (int)((time_ns - window_start) * cycles / (window_end - window_start));
+}
+
+bool InputLogWrite(FILE *file, InputRecord record)
+{
+    uint8_t bytes[8] = {
+        record.frame, record.frame >> 8, record.frame >> 16, record.frame >> 24,
+        record.cycle, record.cycle >> 8, record.key, record.pressed,
+    };
+    return fwrite(bytes, sizeof(bytes), 1, file) == 1;
+}
+
+bool InputLogLoad(InputLog *log, const char *path)
+{
+    *log = (InputLog){ 0 };
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    log->records = malloc((size / 8 + 1) * sizeof(InputRecord));
+    uint8_t bytes[8];
+    while (log->records && fread(bytes, sizeof(bytes), 1, file) == 1) {
+        InputRecord record = {
+            .frame = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24,
+            .cycle = bytes[4] | bytes[5] << 8,
+            .key = bytes[6],
+            .pressed = bytes[7],
+        };
+        if (record.key == INPUT_LOG_END) {
+            log->frames = record.frame;
+            break;
+        }
+        if (record.key > 0xF || (log->count && record.frame < log->records[log->count - 1].frame)) {
+            fprintf(stderr, "%s: not a keypad recording\n", path);
+            fclose(file);
+            InputLogFree(log);
+            return false;
+        }
+        log->records[log->count++] = record;
+    }
+    fclose(file);
+    if (!log->frames && log->count) {
+        log->frames = log->records[log->count - 1].frame + 1; // cut short, ends with its last change
+    }
+    if (!log->frames) {
+        fprintf(stderr, "%s: empty recording\n", path);
+        InputLogFree(log);
+        return false;
+    }
+    return true;
+}
+
+void InputLogFree(InputLog *log)
+{
+    free(log->records);
+    log->records = NULL;
+    log->count = 0;
+}
+
+void InputReplayInit(InputReplay *replay, const InputLog *log)
+{
+    *replay = (InputReplay){ .log = log };
+}
+
+int InputReplayFrame(InputReplay *replay, CHIP8 *chip8, long frame, int cycles)
+{
+    const InputLog *log = replay->log;
+    long at = frame % log->frames;
+    if (at == 0) {
+        replay->next = 0;
+    }
+    for (int i = 0; i < 16; i++) {
+        if (chip8->keypad[i] && replay->instructions - replay->pressed_at[i] >= (uint64_t)cycles) {
+            chip8->prev_keypad[i] = 1;
+        }
+    }
+    int done = 0;
+    while (done < cycles) {
+        int until = cycles;
+        while (replay->next < log->count && log->records[replay->next].frame <= at) {
+            const InputRecord *record = &log->records[replay->next];
+            if (record->frame == at && record->cycle > done) {
+                until = record->cycle < cycles ? record->cycle : cycles;
+                break;
+            }
+            SetKey(chip8, record->key, record->pressed);
+            if (record->pressed) {
+                replay->pressed_at[record->key] = replay->instructions;
+            }
+            replay->next++;
+        }
+        int ran = RunCycles(chip8, until - done);
+        bool stopped = ran < until - done; // e.g. on a breakpoint
+        done += ran;
+        replay->instructions += ran;
+        if (stopped) {
+            break;
+        }
+    }
+    return done;
+}
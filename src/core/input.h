@@ -0,0 +1,89 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "CHIP8.h"
+
+// Keypad changes travel from the thread that reads the devices to the
+// emulation thread through a lock-free single-producer/single-consumer ring.
+// Each event carries the time it happened, so the emulation thread can apply
+// it at the instruction that corresponds to that moment of the frame instead
+// of sampling the whole keypad once per frame: two changes inside one frame
+// stay apart and a tap shorter than a frame is not lost.
+
+#define INPUT_QUEUE_SIZE 256 // power of two
+
+typedef struct {
+    uint64_t time_ns;
+    uint8_t key;             // 0x0-0xF
+    bool pressed;
+} InputEvent;
+
+typedef struct {
+    InputEvent events[INPUT_QUEUE_SIZE];
+    // producer and consumer indices sit on their own cache lines
+    _Alignas(64) atomic_uint head; // next slot to write, owned by the producer
+    _Alignas(64) atomic_uint tail; // next slot to read, owned by the consumer
+} InputQueue;
+
+void InputQueueInit(InputQueue *queue);
+// Returns false and drops the event if the consumer has fallen a whole
+// queue behind.
+bool InputQueuePush(InputQueue *queue, InputEvent event);
+// Copies the oldest event without removing it; false if the queue is empty.
+bool InputQueuePeek(InputQueue *queue, InputEvent *event);
+void InputQueuePop(InputQueue *queue);
+
+// The instruction of a `cycles` long frame covering [window_start, window_end)
+// at which an event from `time_ns` takes effect. Events before the window
+// (e.g. while the debugger had the ROM halted) land on the first instruction.
+int InputEventCycle(uint64_t time_ns, uint64_t window_start, uint64_t window_end, int cycles);
+
+// A `--record` file holds every keypad change the emulation thread applied,
+// at the frame and instruction it was applied, so a replay presses keys at
+// the same instructions the session did. Records are 8 bytes, little
+// endian: frame (32 bits), instruction within the frame (16), key, and 1
+// for a press or 0 for a release. A last record with key INPUT_LOG_END
+// gives the frame the session ended on.
+
+#define INPUT_LOG_END 0xFF
+
+typedef struct {
+    uint32_t frame;
+    uint16_t cycle;
+    uint8_t key;
+    bool pressed;
+} InputRecord;
+
+typedef struct {
+    InputRecord *records;    // in order, without the end record
+    long count;
+    long frames;             // length of the session
+} InputLog;
+
+// Replay state of one machine; several can share a log.
+typedef struct {
+    const InputLog *log;
+    long next;               // first record not applied yet
+    uint64_t instructions;
+    uint64_t pressed_at[16]; // instruction count of the last press
+} InputReplay;
+
+bool InputLogWrite(FILE *file, InputRecord record);
+// Returns false with a message on stderr if the file can't be read or holds
+// no session.
+bool InputLogLoad(InputLog *log, const char *path);
+void InputLogFree(InputLog *log);
+
+void InputReplayInit(InputReplay *replay, const InputLog *log);
+// Runs frame `frame` for `cycles` instructions with the recorded changes
+// applied where they were made, and returns the instructions run. Past the
+// end of the session the recording starts over. Like the live loop, a key
+// held for a whole frame is no longer new to FX0A.
+int InputReplayFrame(InputReplay *replay, CHIP8 *chip8, long frame, int cycles);
+
+#endif
@@ -0,0 +1,105 @@
+#include "library.h"
+#include "hash.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool LibraryOpen(Library *library, const char *path, bool writable)
+{
+    memset(library, 0, sizeof(*library));
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(LibraryHeader)) {
+        fprintf(stderr, "%s: not a ROM library\n", path);
+        close(fd);
+        return false;
+    }
+    void *base = mmap(NULL, info.st_size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+
+    const LibraryHeader *header = base;
+    uint64_t slots_end = sizeof(LibraryHeader) + (uint64_t)header->slot_count * sizeof(uint32_t);
+    uint64_t entries_end = header->entries_offset + (uint64_t)header->entry_count * sizeof(LibraryEntry);
+    if (header->magic != LIBRARY_MAGIC || header->version != LIBRARY_VERSION ||
+        header->slot_count == 0 || (header->slot_count & (header->slot_count - 1)) != 0 ||
+        slots_end > header->entries_offset || entries_end > header->paths_offset ||
+        header->paths_offset + header->paths_size > (uint64_t)info.st_size) {
+        fprintf(stderr, "%s: not a version %d ROM library\n", path, LIBRARY_VERSION);
+        munmap(base, info.st_size);
+        return false;
+    }
+    library->base = base;
+    library->size = info.st_size;
+    library->header = header;
+    library->slots = (const uint32_t *)(header + 1);
+    library->entries = (LibraryEntry *)((uint8_t *)base + header->entries_offset);
+    library->paths = (const char *)base + header->paths_offset;
+    return true;
+}
+
+void LibraryClose(Library *library)
+{
+    if (library->base) {
+        munmap(library->base, library->size);
+    }
+    memset(library, 0, sizeof(*library));
+}
+
+LibraryEntry *LibraryFind(const Library *library, uint64_t hash)
+{
+    uint32_t mask = library->header->slot_count - 1;
+    uint32_t slot = (uint32_t)hash & mask;
+    for (uint32_t probes = 0; probes <= mask; probes++, slot = (slot + 1) & mask) {
+        uint32_t index = library->slots[slot];
+        if (index == 0 || index > library->header->entry_count) {
+            return NULL;
+        }
+        if (library->entries[index - 1].hash == hash) {
+            return &library->entries[index - 1];
+        }
+    }
+    return NULL;
+}
+
+const char *LibraryPath(const Library *library, const LibraryEntry *entry)
+{
+    if (entry->path_offset >= library->header->paths_size) {
+        return "";
+    }
+    return library->paths + entry->path_offset;
+}
+
+uint64_t LibraryHash(const uint8_t *rom, size_t size)
+{
+    return HashBytes(HASH_SEED, rom, size);
+}
+
+void LibraryQuirkNames(uint16_t quirks, char *buffer, size_t buffer_size)
+{
+    static const char *names[] = {
+#define LIBRARY_QUIRK_NAME(name, label) label,
+        LIBRARY_QUIRKS(LIBRARY_QUIRK_NAME)
+#undef LIBRARY_QUIRK_NAME
+    };
+    size_t length = 0;
+    buffer[0] = '\0';
+    for (int i = 0; i < LIBRARY_QUIRK_COUNT; i++) {
+        if (quirks & (1 << i) && length < buffer_size) {
+            length += snprintf(buffer + length, buffer_size - length, "%s%s", length ? " " : "", names[i]);
+        }
+    }
+    if (length == 0) {
+        snprintf(buffer, buffer_size, "none");
+    }
+}
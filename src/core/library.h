@@ -0,0 +1,99 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "CHIP8.h"
+
+// Persistent index of a ROM directory, built by ch8lib and mapped read-only
+// by the frontend. Entries are keyed by the FNV-1a hash of the ROM bytes
+// (the same hash chip8-top shows), so a launch costs one hash of the ROM and
+// a probe of an open-addressed table, however large the library.
+//
+// File layout: LibraryHeader, then `slot_count` uint32 slots (entry index + 1,
+// 0 when empty), then `entry_count` LibraryEntry records, then the
+// NUL-terminated paths they point into. Native byte order; the magic doubles
+// as an endianness check.
+
+#define LIBRARY_MAGIC 0x424C3843 // "C8LB"
+#define LIBRARY_VERSION 1
+#define LIBRARY_ROM_MAX (CHIP8_RAM_SIZE - CHIP8_ROM_ADDR)
+#define LIBRARY_MAP_BYTES (LIBRARY_ROM_MAX / 4) // two bits per ROM byte
+
+// What the analysis saw each ROM byte used as.
+typedef enum {
+    BYTE_UNKNOWN = 0,
+    BYTE_CODE = 1,   // reachable or executed instruction
+    BYTE_DATA = 2,   // read by DRW or FX65
+    BYTE_WRITTEN = 3 // written by FX33 or FX55
+} ByteUse;
+
+// Instructions whose behaviour differs between CHIP-8 interpreters. The core
+// implements one behaviour for each; a ROM that uses none of them runs the
+// same everywhere.
+#define LIBRARY_QUIRKS(X)                                    \
+    X(SHIFT,      "shift")      /* 8XY6/8XYE: Vx or Vy */     \
+    X(LOAD_STORE, "load-store") /* FX55/FX65: I advances? */  \
+    X(JUMP,       "jump")       /* BNNN: V0 or Vx */          \
+    X(LOGIC_VF,   "logic-vf")   /* 8XY1-3: VF reset? */       \
+    X(CLIP,       "clip")       /* DXYN at the edge: wrap or clip */
+
+#define LIBRARY_QUIRK_BIT(name, label) LIBRARY_QUIRK_BIT_##name,
+enum { LIBRARY_QUIRKS(LIBRARY_QUIRK_BIT) LIBRARY_QUIRK_COUNT };
+#undef LIBRARY_QUIRK_BIT
+#define LIBRARY_QUIRK_FLAG(name, label) LIBRARY_QUIRK_##name = 1 << LIBRARY_QUIRK_BIT_##name,
+enum { LIBRARY_QUIRKS(LIBRARY_QUIRK_FLAG) };
+#undef LIBRARY_QUIRK_FLAG
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t slot_count;     // power of two, at least twice entry_count
+    uint64_t entries_offset;
+    uint64_t paths_offset;
+    uint64_t paths_size;
+} LibraryHeader;
+
+typedef struct {
+    uint64_t hash;
+    int64_t mtime_ns;        // of the file when it was indexed
+    uint32_t path_offset;    // into the path table
+    uint16_t size;
+    uint16_t quirks;         // LIBRARY_QUIRK_* the ROM was seen to use
+    uint16_t cycles_per_second; // recommended speed
+    uint16_t snapshot_frame; // frame the snapshot was taken after
+    uint16_t code_bytes;
+    uint16_t data_bytes;
+    Screen snapshot;         // first screen the ROM drew
+    uint8_t map[LIBRARY_MAP_BYTES]; // ByteUse of every ROM byte
+} LibraryEntry;
+
+typedef struct {
+    void *base;              // mapping of the whole file
+    size_t size;
+    const LibraryHeader *header;
+    const uint32_t *slots;
+    LibraryEntry *entries;
+    const char *paths;
+} Library;
+
+// Maps an index; `writable` maps it shared read-write so entries can be
+// edited in place.
+bool LibraryOpen(Library *library, const char *path, bool writable);
+void LibraryClose(Library *library);
+// The entry for a ROM with this content hash, or NULL.
+LibraryEntry *LibraryFind(const Library *library, uint64_t hash);
+const char *LibraryPath(const Library *library, const LibraryEntry *entry);
+
+uint64_t LibraryHash(const uint8_t *rom, size_t size);
+static inline ByteUse LibraryByteUse(const LibraryEntry *entry, int offset)
+{
+    return (ByteUse)(entry->map[offset / 4] >> (offset % 4 * 2) & 3);
+}
+// Space separated names of the quirks in `quirks`.
+void LibraryQuirkNames(uint16_t quirks, char *buffer, size_t buffer_size);
+
+#endif
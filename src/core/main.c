@@ -1,22 +1,70 @@
 #include "CHIP8.h"
+#include "aot.h"
+#include "debugger.h"
+#include "framebuffer.h"
+#include "fusion.h"
+#include "histogram.h"
+#include "input.h"
+#include "library.h"
+#include "netplay.h"
+#include "postprocess.h"
+#include "stats.h"
+#include "trace.h"
 #include <string.h>
+#include <ctype.h>
 #define __USE_MISC
 #include <math.h>
 #undef __USE_MISC
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include <SDL3/SDL.h>
 
 #define CPU_FREQ 500       // CPU frequency in Hz
+#define FRAME_RATE 60      // Timer and display frequency in Hz
 #define BEEP_FREQUENCY 350 // Frequency of beep sound in Hz
 #define BEEP_AMPLITUDE 128 // Amplitude of beep sound
+#define AXIS_THRESHOLD 16384 // stick deflection that counts as a press
+
+// Keyboard scancodes, then gamepad buttons, then both directions of every
+// gamepad axis share one index space so a single table maps them all.
+#define PAD_BUTTON_INPUT(button) (SDL_SCANCODE_COUNT + (button))
+#define PAD_AXIS_INPUT(axis, positive) (PAD_BUTTON_INPUT(SDL_GAMEPAD_BUTTON_COUNT) + 2 * (axis) + (positive))
+#define INPUT_COUNT PAD_AXIS_INPUT(SDL_GAMEPAD_AXIS_COUNT, 0)
+
+// The keypad on the left block of a QWERTY keyboard, as laid out in the
+// readme; a gamepad steers with 5/7/8/9, which most games use as W/A/S/D.
+static const struct {
+    int input;
+    int8_t key;
+} default_keymap[] = {
+    { SDL_SCANCODE_1, 0x1 }, { SDL_SCANCODE_2, 0x2 }, { SDL_SCANCODE_3, 0x3 }, { SDL_SCANCODE_4, 0xC },
+    { SDL_SCANCODE_Q, 0x4 }, { SDL_SCANCODE_W, 0x5 }, { SDL_SCANCODE_E, 0x6 }, { SDL_SCANCODE_R, 0xD },
+    { SDL_SCANCODE_A, 0x7 }, { SDL_SCANCODE_S, 0x8 }, { SDL_SCANCODE_D, 0x9 }, { SDL_SCANCODE_F, 0xE },
+    { SDL_SCANCODE_Z, 0xA }, { SDL_SCANCODE_X, 0x0 }, { SDL_SCANCODE_C, 0xB }, { SDL_SCANCODE_V, 0xF },
+    { PAD_BUTTON_INPUT(SDL_GAMEPAD_BUTTON_DPAD_UP), 0x5 },
+    { PAD_BUTTON_INPUT(SDL_GAMEPAD_BUTTON_DPAD_LEFT), 0x7 },
+    { PAD_BUTTON_INPUT(SDL_GAMEPAD_BUTTON_DPAD_DOWN), 0x8 },
+    { PAD_BUTTON_INPUT(SDL_GAMEPAD_BUTTON_DPAD_RIGHT), 0x9 },
+    { PAD_AXIS_INPUT(SDL_GAMEPAD_AXIS_LEFTY, 0), 0x5 },
+    { PAD_AXIS_INPUT(SDL_GAMEPAD_AXIS_LEFTX, 0), 0x7 },
+    { PAD_AXIS_INPUT(SDL_GAMEPAD_AXIS_LEFTY, 1), 0x8 },
+    { PAD_AXIS_INPUT(SDL_GAMEPAD_AXIS_LEFTX, 1), 0x9 },
+    { PAD_BUTTON_INPUT(SDL_GAMEPAD_BUTTON_SOUTH), 0x6 },
+    { PAD_BUTTON_INPUT(SDL_GAMEPAD_BUTTON_EAST), 0x4 },
+    { PAD_BUTTON_INPUT(SDL_GAMEPAD_BUTTON_WEST), 0x1 },
+    { PAD_BUTTON_INPUT(SDL_GAMEPAD_BUTTON_NORTH), 0x2 },
+};
 
 typedef struct {
     int sample_rate;
     int frequency;
     int phase;
-    bool is_beeping;
+    SDL_AtomicInt is_beeping; // written by the emulation thread, read by the audio callback
+    SDL_AtomicInt underruns;  // written by the audio callback, read by the emulation thread
+    Uint64 last_callback_ns;
+    Uint64 last_supplied_ns;  // length of the audio the last callback produced
 } BeepData;
 
 typedef struct {
@@ -25,78 +73,340 @@ typedef struct {
     SDL_Renderer* renderer;
     SDL_AudioDeviceID audio_device;
     SDL_AudioStream* audio_stream;
-    SDL_FRect pixel_buffer[64 * 32];
+    SDL_Thread* emulation_thread;
+    SDL_Texture* texture;
+    PostProcess post;     // render thread only
+    Screen last_screen;   // redrawn while the phosphor fades
+    bool fading;
+    Uint64 last_draw_ns;
     BeepData beep_data;
-    bool running;
-    int pixel_size;
-    SDL_Color color;
+    SDL_AtomicInt running;
+    InputQueue input;    // keypad events from the main thread
+    int8_t keymap[INPUT_COUNT]; // CHIP-8 key of each input, -1 if unmapped
+    bool input_down[INPUT_COUNT]; // main thread only
+    uint8_t key_holds[16];       // inputs holding each CHIP-8 key, main thread only
+    uint64_t key_pressed_at[16]; // instruction count of the last press, emulation thread only
+    TripleBuffer frames; // completed screens published by the emulation thread
+    Debugger debugger;   // owned by the emulation thread
+    Tracer tracer;
+    FusionTable fusion;
+    AotState aot;
+    Netplay netplay;
+    bool netplay_active;
+    uint16_t netplay_keys; // local keypad, sampled once per frame in netplay
+    FILE* input_log;     // every keypad change applied, for replaying a session
+    FrameHistogram emulation_times;
+    FrameHistogram render_times;
+    StatsPublisher stats; // live counters for chip8-top
+    int cpu_freq;         // instructions per second, CPU_FREQ unless the library says otherwise
     int screen_width;
     int screen_height;
 } App;
 
 
-void init(App* app, const char* rom);
-void draw(App* app);
-void update_kbd(CHIP8* chip8);
+void init(App* app, const char* rom, bool debug);
+void apply_library(App* app, const char* library_path, long rom_size);
+bool load_keymap(App* app, const char* path);
+void handle_event(App* app, const SDL_Event* event);
+void draw(App* app, const uint64_t* screen);
 void cleanup(App* app);
 
+static int emulation_thread(void* data);
+static int apply_input(App* app, uint64_t frame, int done, int cycles, uint64_t instructions, Uint64 window_start, Uint64 window_end);
+static int netplay_frame(App* app, Uint64 now);
+static void record_input(App* app, InputRecord record);
+static bool open_netplay(App* app, const char* local_port, const char* peer, long rom_size);
+
 int main(int argc, char* argv[]){
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <ROM file>\n", argv[0]);
+    const char* rom = NULL;
+    const char* trace_path = NULL;
+    const char* aot_path = NULL;
+    const char* record_path = NULL;
+    const char* library_path = getenv("CHIP8_LIBRARY");
+    const char* keymap_path = getenv("CHIP8_KEYMAP");
+    const char* netplay_port = NULL;
+    const char* netplay_peer = NULL;
+    bool debug = getenv("CHIP8_DEBUG_SOCKET") != NULL;
+    PostProcess post = { .scale = 10 };
+    PostProcessParsePalette("white", &post.palette);
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--aot") == 0 && i + 1 < argc) {
+            aot_path = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--library") == 0 && i + 1 < argc) {
+            library_path = argv[++i];
+        } else if (strcmp(argv[i], "--keymap") == 0 && i + 1 < argc) {
+            keymap_path = argv[++i];
+        } else if (strcmp(argv[i], "--netplay") == 0 && i + 2 < argc) {
+            netplay_port = argv[++i];
+            netplay_peer = argv[++i];
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            post.scale = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scaler") == 0 && i + 1 < argc) {
+            usage |= !PostProcessParseScaler(argv[++i], &post.scaler);
+        } else if (strcmp(argv[i], "--palette") == 0 && i + 1 < argc) {
+            usage |= !PostProcessParsePalette(argv[++i], &post.palette);
+        } else if (strcmp(argv[i], "--phosphor") == 0 && i + 1 < argc) {
+            post.persistence = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scanlines") == 0) {
+            post.scanlines = true;
+        } else if (strcmp(argv[i], "--debug") == 0) {
+            debug = true;
+        } else {
+            rom = argv[i];
+        }
+    }
+    if (!rom || usage) {
+        fprintf(stderr, "Usage: %s [--trace <file>] [--aot <compiled.so>] [--record <file>] [--library <index>] [--keymap <file>] [--netplay <port> <host:port>]\n"
+                        "       [--debug] [--scale <n>] [--scaler nearest|epx] [--palette <name>|<RRGGBB:RRGGBB>] [--phosphor <percent>] [--scanlines] <ROM file>\n", argv[0]);
+        return 1;
+    }
+    if (netplay_port && (trace_path || aot_path || record_path)) {
+        // rollback re-runs frames, which these would see twice
+        fprintf(stderr, "--netplay can't be combined with --trace, --aot or --record\n");
         return 1;
     }
-    App app = {0};
+    static App app = {0};
+    app.post = post;
 
-    init(&app, argv[1]);
+    init(&app, rom, debug);
 
-    LoadROM(&app.chip8, argv[1]);
-    SDL_Time start, end;
-    while(app.running) {
-        start = SDL_GetTicks();
-        Instruction instruction = FetchInstruction(&app.chip8);
-        ExecuteInstruction(&app.chip8, instruction);
-        // Update timers and other logic here
-        if(app.chip8.screen_changed) {
-            app.chip8.screen_changed = 0;
-            draw(&app);
+    app.chip8.fusion = &app.fusion;
+    long rom_size = LoadROM(&app.chip8, rom);
+    if (rom_size < 0) {
+        cleanup(&app);
+        return 1;
+    }
+    if (library_path) {
+        apply_library(&app, library_path, rom_size);
+    }
+    StatsOpen(&app.stats, rom, app.chip8.ram + CHIP8_ROM_ADDR, rom_size); // optional, like the debugger stub
+    if (aot_path && !AotLoad(&app.aot, aot_path, &app.chip8)) {
+        cleanup(&app);
+        return 1;
+    }
+    if (trace_path && !TracerOpen(&app.tracer, &app.chip8, trace_path)) {
+        cleanup(&app);
+        return 1;
+    }
+    if (keymap_path && !load_keymap(&app, keymap_path)) {
+        cleanup(&app);
+        return 1;
+    }
+    if (record_path && !(app.input_log = fopen(record_path, "wb"))) {
+        perror("Failed to open input recording");
+        cleanup(&app);
+        return 1;
+    }
+    if (netplay_port && !open_netplay(&app, netplay_port, netplay_peer, rom_size)) {
+        cleanup(&app);
+        return 1;
+    }
+
+    app.emulation_thread = SDL_CreateThread(emulation_thread, "emulation", &app);
+    if (!app.emulation_thread) {
+        fprintf(stderr, "Could not create emulation thread: %s\n", SDL_GetError());
+        cleanup(&app);
+        return 1;
+    }
+
+    // The main thread only handles events and presents frames,
+    // so a slow present never stalls the core.
+    while (SDL_GetAtomicInt(&app.running)) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_EVENT_QUIT) {
+                SDL_SetAtomicInt(&app.running, 0);
+            }
+            handle_event(&app, &event);
         }
-        if(app.chip8.delay_timer > 0) {
-            app.chip8.delay_timer--;
+
+        const uint64_t* screen = NULL;
+        if (TripleBufferAcquire(&app.frames)) {
+            screen = TripleBufferFront(&app.frames);
+        } else if (app.fading && SDL_GetTicksNS() - app.last_draw_ns >= SDL_NS_PER_SECOND / FRAME_RATE) {
+            screen = app.last_screen; // no new frame, but the glow keeps fading
+        }
+        if (screen) {
+            Uint64 start = SDL_GetTicksNS();
+            draw(&app, screen);
+            Uint64 elapsed = SDL_GetTicksNS() - start;
+            HistogramRecord(&app.render_times, elapsed);
+            StatsPublishRender(&app.stats, elapsed, &app.render_times);
+        } else {
+            SDL_WaitEventTimeout(NULL, 1);
         }
+    }
+    SDL_WaitThread(app.emulation_thread, NULL);
+    TracerClose(&app.tracer, &app.chip8);
+    cleanup(&app);
+    return 0;
+}
+
+static int emulation_thread(void* data)
+{
+    App* app = data;
+    CHIP8* chip8 = &app->chip8;
+    uint64_t frame = 0;
+    uint64_t instructions = 0, dropped_frames = 0, skipped_frames = 0;
+    Uint64 next_frame = SDL_GetTicksNS();
+    Uint64 input_start = next_frame; // input since then is replayed over the next frame
 
-        if(app.chip8.sound_timer > 0) {
-            if (!app.beep_data.is_beeping) {
-                app.beep_data.is_beeping = true;
+    while (SDL_GetAtomicInt(&app->running)) {
+        DebuggerPoll(&app->debugger, 0);
+        if (app->debugger.halted) {
+            while (app->debugger.halted && SDL_GetAtomicInt(&app->running)) {
+                DebuggerPoll(&app->debugger, 50);
             }
-            app.chip8.sound_timer--;
+            next_frame = SDL_GetTicksNS(); // don't rush to catch up after a halt
+        }
+        Uint64 start = SDL_GetTicksNS();
+
+        if (app->netplay_active) {
+            instructions += netplay_frame(app, start);
         } else {
-            if (app.beep_data.is_beeping) {
-                app.beep_data.is_beeping = false;
+            // spread CPU_FREQ evenly over the frames of each second
+            int cycles = (int)((frame + 1) * app->cpu_freq / FRAME_RATE - frame * app->cpu_freq / FRAME_RATE);
+
+            // FX0A sees a press as new for a frame's worth of instructions, as it
+            // did when the keypad was latched once per frame
+            for (int i = 0; i < 16; i++) {
+                if (chip8->keypad[i] && instructions - app->key_pressed_at[i] >= (uint64_t)cycles) {
+                    chip8->prev_keypad[i] = 1;
+                }
             }
-        }
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_EVENT_QUIT) {
-                app.running = false;
+            for (int done = 0; done < cycles && SDL_GetAtomicInt(&app->running); ) {
+                int until = apply_input(app, frame, done, cycles, instructions, input_start, start);
+                int ran = RunCycles(chip8, until - done);
+                done += ran;
+                instructions += ran;
+                if (chip8->debug_break) {
+                    DebuggerStop(&app->debugger);
+                    while (app->debugger.halted && SDL_GetAtomicInt(&app->running)) {
+                        DebuggerPoll(&app->debugger, 50);
+                    }
+                    next_frame = SDL_GetTicksNS();
+                }
             }
+            input_start = start;
+            UpdateTimers(chip8);
+        }
+        SDL_SetAtomicInt(&app->beep_data.is_beeping, chip8->sound_timer > 0);
+
+        if (chip8->screen_changed) {
+            chip8->screen_changed = 0;
+            memcpy(TripleBufferBack(&app->frames), chip8->screen, sizeof(Screen));
+            dropped_frames += TripleBufferPublish(&app->frames);
         }
-        update_kbd(&app.chip8);
-        end = SDL_GetTicks();
-        int delay = (1.0 / CPU_FREQ) * 1000 - (end - start);
-        if (delay > 0) {
-            SDL_Delay(delay);
+        frame++;
+
+        Uint64 end = SDL_GetTicksNS();
+        HistogramRecord(&app->emulation_times, end - start);
+        StatsPublishEmulation(&app->stats, end, instructions, &app->emulation_times,
+            dropped_frames, skipped_frames, SDL_GetAtomicInt(&app->beep_data.underruns));
+
+        next_frame += SDL_NS_PER_SECOND / FRAME_RATE;
+        if (end < next_frame) {
+            SDL_DelayPrecise(next_frame - end);
+        } else if (end - next_frame > 4 * SDL_NS_PER_SECOND / FRAME_RATE) {
+            skipped_frames += (end - next_frame) * FRAME_RATE / SDL_NS_PER_SECOND;
+            next_frame = end; // fell too far behind, don't try to catch up
         }
     }
-    cleanup(&app);
+    record_input(app, (InputRecord){ .frame = frame, .key = INPUT_LOG_END });
     return 0;
 }
 
+// One netplay tick. Remote input comes a frame at a time, so local input is
+// too: the keypad mask is whatever is held when the tick starts. Returns the
+// instructions run, not counting re-run frames.
+static int netplay_frame(App* app, Uint64 now)
+{
+    InputEvent event;
+    while (InputQueuePeek(&app->input, &event) && event.time_ns < now) {
+        if (event.pressed) {
+            app->netplay_keys |= 1 << event.key;
+        } else {
+            app->netplay_keys &= ~(1 << event.key);
+        }
+        InputQueuePop(&app->input);
+    }
+    uint32_t frame = app->netplay.frame;
+    uint64_t rollbacks = app->netplay.stats.rollbacks;
+    bool advanced = NetplayAdvance(&app->netplay, &app->chip8, app->netplay_keys, now);
+    if (app->netplay.stats.rollbacks != rollbacks) {
+        app->chip8.screen_changed = 1; // the corrected frames may not draw what the predicted ones did
+    }
+    if (!advanced) {
+        return 0;
+    }
+    return (int)((frame + 1ULL) * app->cpu_freq / FRAME_RATE - (uint64_t)frame * app->cpu_freq / FRAME_RATE);
+}
+
+// Applies the queued key changes that are due by instruction `done` of this
+// frame, logging them for --record, and returns the instruction the next one is due at, or `cycles`. The
+// frame's instructions stand for the time between `window_start` and
+// `window_end`, so a change lands as far into the frame as it happened into
+// that interval. Only events from before `window_end` are taken; later ones
+// belong to the next frame.
+static int apply_input(App* app, uint64_t frame, int done, int cycles, uint64_t instructions, Uint64 window_start, Uint64 window_end)
+{
+    InputEvent event;
+    while (InputQueuePeek(&app->input, &event) && event.time_ns < window_end) {
+        int at = InputEventCycle(event.time_ns, window_start, window_end, cycles);
+        // a tap shorter than an instruction still lasts one, so the ROM can see it
+        if (!event.pressed && app->key_pressed_at[event.key] == instructions) {
+            at = done + 1;
+        }
+        if (at > done) {
+            return at < cycles ? at : cycles;
+        }
+        SetKey(&app->chip8, event.key, event.pressed);
+        if (event.pressed) {
+            app->key_pressed_at[event.key] = instructions;
+        }
+        record_input(app, (InputRecord){ frame, done, event.key, event.pressed });
+        InputQueuePop(&app->input);
+    }
+    return cycles;
+}
+
+// Appends to the --record log, if there is one. The first failed write
+// ends the recording, so a log never has a hole in the middle.
+static void record_input(App* app, InputRecord record)
+{
+    if (app->input_log && !InputLogWrite(app->input_log, record)) {
+        perror("Failed to write input recording; recording stopped");
+        fclose(app->input_log);
+        app->input_log = NULL;
+    }
+}
+
 static void fill_callback(void *userdata, SDL_AudioStream *stream, int approx_request, int _) {
     BeepData *beep = (BeepData *)userdata;
+    if (approx_request <= 0) {
+        return; // nothing asked for: no timing to learn from and nothing to allocate
+    }
+
+    // The device ran dry if we're called well after the audio we supplied
+    // last time has played out.
+    Uint64 now = SDL_GetTicksNS();
+    if (beep->last_callback_ns && now - beep->last_callback_ns > 2 * beep->last_supplied_ns) {
+        SDL_AddAtomicInt(&beep->underruns, 1);
+    }
+    beep->last_callback_ns = now;
+    beep->last_supplied_ns = (Uint64)approx_request * SDL_NS_PER_SECOND / beep->sample_rate;
 
     uint8_t *buffer = (uint8_t *)malloc(approx_request);
-    if (!buffer) return;
-    if(!beep->is_beeping) {
+    if (!buffer) {
+        SDL_AddAtomicInt(&beep->underruns, 1);
+        return;
+    }
+    if(!SDL_GetAtomicInt(&beep->is_beeping)) {
         memset(buffer, 128, approx_request);
         uint8_t tone = sin((2 * M_PI * beep->phase) / (beep->sample_rate / beep->frequency)) * BEEP_AMPLITUDE + 128;
         int i = 0;
@@ -114,26 +424,44 @@ static void fill_callback(void *userdata, SDL_AudioStream *stream, int approx_re
         beep->phase = (beep->phase + 1) % (beep->sample_rate / beep->frequency);
         buffer[i] = sin((2 * M_PI * beep->phase) / (beep->sample_rate / beep->frequency)) * BEEP_AMPLITUDE + 128;
     }
-    
+
     SDL_PutAudioStreamData(stream, buffer, approx_request);
-    
+
     free(buffer);
 }
 
-void init(App* app, const char* rom)
+void init(App* app, const char* rom, bool debug)
 {
-    app->pixel_size = 10; // Size of each pixel in the window
-    app->running = true;
-    app->screen_width = 64 * app->pixel_size;
-    app->screen_height = 32 * app->pixel_size;
-    app->color.r = 255;
-    app->color.g = 255;
-    app->color.b = 255;
-    app->color.a = 255;
+    if (!PostProcessInit(&app->post)) {
+        exit(1);
+    }
+    app->cpu_freq = CPU_FREQ;
+    SDL_SetAtomicInt(&app->running, 1);
+    app->screen_width = app->post.width;
+    app->screen_height = app->post.height;
     InitializeCHIP8(&app->chip8);
+    InputQueueInit(&app->input);
+    memset(app->keymap, -1, sizeof(app->keymap));
+    for (size_t i = 0; i < sizeof(default_keymap) / sizeof(default_keymap[0]); i++) {
+        app->keymap[default_keymap[i].input] = default_keymap[i].key;
+    }
+    TripleBufferInit(&app->frames);
 
+    // The debugger stub only listens when asked to, with --debug or
+    // $CHIP8_DEBUG_SOCKET, so tools can attach to a running instance.
+    char socket_path[108];
+    const char* env_path = getenv("CHIP8_DEBUG_SOCKET");
+    if (env_path) {
+        snprintf(socket_path, sizeof(socket_path), "%s", env_path);
+    } else {
+        snprintf(socket_path, sizeof(socket_path), "/tmp/chip8-%d.sock", (int)getpid());
+    }
+    if (!DebuggerInit(&app->debugger, &app->chip8, debug ? socket_path : NULL)) {
+        DebuggerInit(&app->debugger, &app->chip8, NULL); // keep running without a stub
+    }
 
-    if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
+
+    if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMEPAD)) {
         fprintf(stderr, "Could not initialize SDL: %s\n", SDL_GetError());
         exit(1);
     }
@@ -152,13 +480,13 @@ void init(App* app, const char* rom)
         SDL_Quit();
         exit(1);
     }
-    
+
     // Initialize beep data
     app->beep_data.sample_rate = 44100;
     app->beep_data.frequency = BEEP_FREQUENCY;
     app->beep_data.phase = 0;
-    app->beep_data.is_beeping = false;
-    
+    SDL_SetAtomicInt(&app->beep_data.is_beeping, 0);
+
     app->audio_stream = SDL_CreateAudioStream(&audio_spec, &audio_spec);
     if(!app->audio_stream) {
         fprintf(stderr, "Failed to create audio stream: %s\n", SDL_GetError());
@@ -180,7 +508,7 @@ void init(App* app, const char* rom)
     for(; rom[offset] != '/' && offset != 0; offset--);
     char window_name[256];
     snprintf(window_name, sizeof(window_name), "CHIP-8 Emulator - %s", rom + offset + 1);
-    
+
     SDL_CreateWindowAndRenderer(window_name, app->screen_width, app->screen_height, 0, &app->window, &app->renderer);
     if (!app->window || !app->renderer) {
         fprintf(stderr, "Could not create window or renderer: %s\n", SDL_GetError());
@@ -188,57 +516,211 @@ void init(App* app, const char* rom)
         SDL_Quit();
         exit(1);
     }
+    // post-processing already scaled the image; the texture is shown 1:1
+    app->texture = SDL_CreateTexture(app->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                     app->post.width, app->post.height);
+    if (!app->texture) {
+        fprintf(stderr, "Could not create texture: %s\n", SDL_GetError());
+        SDL_CloseAudioDevice(app->audio_device);
+        SDL_Quit();
+        exit(1);
+    }
+    SDL_SetTextureScaleMode(app->texture, SDL_SCALEMODE_NEAREST);
 }
 
-void draw(App* app)
+// Looks the loaded ROM up in a ch8lib index and takes its recommended speed.
+void apply_library(App* app, const char* library_path, long rom_size)
 {
-    SDL_SetRenderDrawColor(app->renderer, 0, 0, 0, 255);
-    SDL_RenderClear(app->renderer);
-    SDL_SetRenderDrawColor(app->renderer, app->color.r, app->color.g, app->color.b, app->color.a);
-    int count = 0;
-    for (int row = 0; row < 32; row++) {
-        for (int col = 0; col < 64; col++) {
-            uint8_t pixel = (app->chip8.screen[row] >> (63 - col)) & 1;
-            if (pixel) {
-                app->pixel_buffer[count++] = (SDL_FRect){.x = col * app->pixel_size, row * app->pixel_size, app->pixel_size, app->pixel_size};
-            }
-        }
+    Library library;
+    if (!LibraryOpen(&library, library_path, false)) {
+        return;
+    }
+    const LibraryEntry* entry = LibraryFind(&library, LibraryHash(app->chip8.ram + CHIP8_ROM_ADDR, rom_size));
+    if (entry) {
+        char quirks[128];
+        LibraryQuirkNames(entry->quirks, quirks, sizeof(quirks));
+        app->cpu_freq = entry->cycles_per_second ? entry->cycles_per_second : CPU_FREQ;
+        fprintf(stderr, "library: %d Hz, quirk-sensitive instructions: %s\n", app->cpu_freq, quirks);
+    } else {
+        fprintf(stderr, "library: ROM not indexed, running at %d Hz\n", app->cpu_freq);
+    }
+    LibraryClose(&library);
+}
+
+// Parses "host:port" and connects to the other player. The ROM hash and
+// speed go in every packet so mismatched peers refuse each other.
+static bool open_netplay(App* app, const char* local_port, const char* peer, long rom_size)
+{
+    char host[256];
+    const char* colon = strrchr(peer, ':');
+    if (!colon || colon == peer || (size_t)(colon - peer) >= sizeof(host)) {
+        fprintf(stderr, "netplay: expected host:port, got %s\n", peer);
+        return false;
     }
-    if (count > 0) {
-        SDL_RenderFillRects(app->renderer, app->pixel_buffer, count);
+    memcpy(host, peer, colon - peer);
+    host[colon - peer] = '\0';
+    uint64_t rom_hash = LibraryHash(app->chip8.ram + CHIP8_ROM_ADDR, rom_size);
+    if (!NetplayOpen(&app->netplay, atoi(local_port), host, atoi(colon + 1), rom_hash, app->cpu_freq)) {
+        return false;
     }
+    // rollback re-runs frames, so a stop in one can't be resumed; close the
+    // stub rather than accept breakpoints that would never fire
+    DebuggerClose(&app->debugger);
+    DebuggerInit(&app->debugger, &app->chip8, NULL);
+    app->netplay_active = true;
+    return true;
+}
+
+void draw(App* app, const uint64_t* screen)
+{
+    if (screen != app->last_screen) {
+        memcpy(app->last_screen, screen, sizeof(Screen));
+    }
+    app->fading = PostProcessFrame(&app->post, screen);
+    app->last_draw_ns = SDL_GetTicksNS();
+    SDL_UpdateTexture(app->texture, NULL, app->post.pixels, app->post.width * sizeof(uint32_t));
+    SDL_RenderTexture(app->renderer, app->texture, NULL, NULL);
     SDL_RenderPresent(app->renderer);
 }
 
-void update_kbd(CHIP8* chip8)
+// Keyboard and gamepad changes go to the emulation thread as timestamped
+// keypad events; key repeats and stick jitter inside the dead zone are
+// dropped here.
+static void set_input(App* app, int input, bool down, Uint64 time_ns)
+{
+    if (input < 0 || input >= INPUT_COUNT || app->input_down[input] == down) {
+        return;
+    }
+    app->input_down[input] = down;
+    int key = app->keymap[input];
+    if (key < 0) {
+        return;
+    }
+    // several inputs may hold one key; it goes up with the last of them
+    if (down ? app->key_holds[key]++ > 0 : --app->key_holds[key] > 0) {
+        return;
+    }
+    if (!InputQueuePush(&app->input, (InputEvent){ .time_ns = time_ns, .key = key, .pressed = down })) {
+        // the emulation thread is stuck (halted in the debugger); forget the
+        // change so the next one is sent again
+        app->input_down[input] = !down;
+        app->key_holds[key] += down ? -1 : 1;
+    }
+}
+
+void handle_event(App* app, const SDL_Event* event)
+{
+    switch (event->type) {
+    case SDL_EVENT_KEY_DOWN:
+    case SDL_EVENT_KEY_UP:
+        set_input(app, event->key.scancode, event->key.down, event->key.timestamp);
+        break;
+    case SDL_EVENT_GAMEPAD_BUTTON_DOWN:
+    case SDL_EVENT_GAMEPAD_BUTTON_UP:
+        set_input(app, PAD_BUTTON_INPUT(event->gbutton.button), event->gbutton.down, event->gbutton.timestamp);
+        break;
+    case SDL_EVENT_GAMEPAD_AXIS_MOTION:
+        set_input(app, PAD_AXIS_INPUT(event->gaxis.axis, 1), event->gaxis.value > AXIS_THRESHOLD, event->gaxis.timestamp);
+        set_input(app, PAD_AXIS_INPUT(event->gaxis.axis, 0), event->gaxis.value < -AXIS_THRESHOLD, event->gaxis.timestamp);
+        break;
+    case SDL_EVENT_GAMEPAD_ADDED:
+        if (!SDL_OpenGamepad(event->gdevice.which)) {
+            fprintf(stderr, "Could not open gamepad: %s\n", SDL_GetError());
+        }
+        break;
+    case SDL_EVENT_GAMEPAD_REMOVED:
+        SDL_CloseGamepad(SDL_GetGamepadFromID(event->gdevice.which));
+        // release whatever it was holding
+        for (int input = PAD_BUTTON_INPUT(0); input < INPUT_COUNT; input++) {
+            set_input(app, input, false, event->gdevice.timestamp);
+        }
+        break;
+    }
+}
+
+// An input name: an SDL scancode name ("W", "Up", "Keypad 8"), "pad:<button>"
+// ("pad:dpup", "pad:a", SDL's gamepad mapping names) or "pad:+<axis>"/"pad:-<axis>" ("pad:-lefty").
+static int parse_input(const char* name)
+{
+    if (strncmp(name, "pad:", 4) != 0) {
+        SDL_Scancode scancode = SDL_GetScancodeFromName(name);
+        return scancode == SDL_SCANCODE_UNKNOWN ? -1 : scancode;
+    }
+    name += 4;
+    if (name[0] == '+' || name[0] == '-') {
+        SDL_GamepadAxis axis = SDL_GetGamepadAxisFromString(name + 1);
+        return axis == SDL_GAMEPAD_AXIS_INVALID ? -1 : PAD_AXIS_INPUT(axis, name[0] == '+');
+    }
+    SDL_GamepadButton button = SDL_GetGamepadButtonFromString(name);
+    return button == SDL_GAMEPAD_BUTTON_INVALID ? -1 : PAD_BUTTON_INPUT(button);
+}
+
+// Replaces the default mapping with one read from `path`: one
+// "<key> <input>" pair per line, the key as a hex digit, '#' comments.
+bool load_keymap(App* app, const char* path)
 {
-    memcpy(chip8->prev_keypad, chip8->keypad, sizeof(chip8->keypad)); // save last frame
-
-    memset(chip8->keypad, 0, sizeof(chip8->keypad));
-
-    const bool* keys = SDL_GetKeyboardState(NULL);
-    if (keys[SDL_SCANCODE_1]) chip8->keypad[0x0] = 1;
-    if (keys[SDL_SCANCODE_2]) chip8->keypad[0x1] = 1;
-    if (keys[SDL_SCANCODE_3]) chip8->keypad[0x2] = 1;
-    if (keys[SDL_SCANCODE_4]) chip8->keypad[0x3] = 1;
-    if (keys[SDL_SCANCODE_Q]) chip8->keypad[0x4] = 1;
-    if (keys[SDL_SCANCODE_W]) chip8->keypad[0x5] = 1;
-    if (keys[SDL_SCANCODE_E]) chip8->keypad[0x6] = 1;
-    if (keys[SDL_SCANCODE_R]) chip8->keypad[0x7] = 1;
-    if (keys[SDL_SCANCODE_A]) chip8->keypad[0x8] = 1;
-    if (keys[SDL_SCANCODE_S]) chip8->keypad[0x9] = 1;
-    if (keys[SDL_SCANCODE_D]) chip8->keypad[0xA] = 1;
-    if (keys[SDL_SCANCODE_F]) chip8->keypad[0xB] = 1;
-    if (keys[SDL_SCANCODE_Z]) chip8->keypad[0xC] = 1;
-    if (keys[SDL_SCANCODE_X]) chip8->keypad[0xD] = 1;
-    if (keys[SDL_SCANCODE_C]) chip8->keypad[0xE] = 1;
-    if (keys[SDL_SCANCODE_V]) chip8->keypad[0xF] = 1;
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    memset(app->keymap, -1, sizeof(app->keymap));
+    char line[128];
+    int line_number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        char* text = line + strspn(line, " \t");
+        if (*text == '\0') {
+            continue;
+        }
+        char digit[2] = { text[0], '\0' };
+        char* name = text + 1 + strspn(text + 1, " \t");
+        if (!isxdigit((unsigned char)text[0]) || name == text + 1 || *name == '\0') {
+            fprintf(stderr, "%s:%d: expected \"<key> <input>\"\n", path, line_number);
+            ok = false;
+            break;
+        }
+        for (char* end = name + strlen(name); end > name && (end[-1] == ' ' || end[-1] == '\t'); ) {
+            *--end = '\0';
+        }
+        int input = parse_input(name);
+        if (input < 0) {
+            fprintf(stderr, "%s:%d: unknown input \"%s\"\n", path, line_number, name);
+            ok = false;
+            break;
+        }
+        app->keymap[input] = (int8_t)strtol(digit, NULL, 16);
+    }
+    fclose(file);
+    return ok;
 }
 
 void cleanup(App* app)
 {
+    HistogramPrint(&app->emulation_times, "emulation");
+    HistogramPrint(&app->render_times, "render");
+    FusionReport(&app->fusion, stderr);
+    AotReport(&app->aot, stderr);
+    AotClose(&app->aot, &app->chip8);
+    if (app->netplay_active) {
+        const NetplayStats* stats = &app->netplay.stats;
+        fprintf(stderr, "netplay: %llu frames, %llu stalls, %llu rollbacks (%llu frames re-run, %d max), %llu desyncs\n",
+            (unsigned long long)stats->frames, (unsigned long long)stats->stalls,
+            (unsigned long long)stats->rollbacks, (unsigned long long)stats->rollback_frames,
+            stats->max_rollback, (unsigned long long)stats->desyncs);
+        NetplayClose(&app->netplay);
+    }
+    StatsClose(&app->stats);
+    if (app->input_log) {
+        fclose(app->input_log);
+    }
+    DebuggerClose(&app->debugger);
     SDL_CloseAudioDevice(app->audio_device);
+    SDL_DestroyTexture(app->texture);
     SDL_DestroyRenderer(app->renderer);
     SDL_DestroyWindow(app->window);
     SDL_Quit();
-}
\ No newline at end of file
+    PostProcessFree(&app->post);
+}
@@ -0,0 +1,386 @@
+#define _GNU_SOURCE // SOCK_NONBLOCK
+#include "netplay.h"
+#include "hash.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define FRAME_RATE 60
+#define NO_FRAME UINT32_MAX
+
+static void put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) out[i] = value >> (8 * i);
+}
+
+static void put_u64(uint8_t *out, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) out[i] = value >> (8 * i);
+}
+
+static uint16_t get_u16(const uint8_t *in)
+{
+    return in[0] | in[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *in)
+{
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static uint64_t get_u64(const uint8_t *in)
+{
+    return get_u32(in) | (uint64_t)get_u32(in + 4) << 32;
+}
+
+bool NetplayOpen(Netplay *netplay, int local_port, const char *peer_host, int peer_port,
+                 uint64_t rom_hash, int cpu_freq)
+{
+    memset(netplay, 0, sizeof(*netplay));
+    netplay->fd = -1;
+    netplay->rom_hash = rom_hash;
+    netplay->cpu_freq = cpu_freq;
+    netplay->rollback_from = NO_FRAME;
+    netplay->compared_check = NO_FRAME;
+    netplay->link.random = 1;
+
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM }, *found;
+    char port[16];
+    snprintf(port, sizeof(port), "%d", peer_port);
+    int error = getaddrinfo(peer_host, port, &hints, &found);
+    if (error) {
+        fprintf(stderr, "netplay: %s: %s\n", peer_host, gai_strerror(error));
+        return false;
+    }
+    memcpy(&netplay->peer, found->ai_addr, sizeof(netplay->peer));
+    freeaddrinfo(found);
+
+    netplay->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_in local = {
+        .sin_family = AF_INET,
+        .sin_port = htons(local_port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (netplay->fd < 0 || bind(netplay->fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        fprintf(stderr, "netplay: port %d: %s\n", local_port, strerror(errno));
+        NetplayClose(netplay);
+        return false;
+    }
+    return true;
+}
+
+void NetplayClose(Netplay *netplay)
+{
+    if (netplay->fd >= 0) {
+        close(netplay->fd);
+    }
+    netplay->fd = -1;
+}
+
+void NetplaySetLink(Netplay *netplay, int delay_ms, int jitter_ms, int loss_percent, uint64_t seed)
+{
+    NetplayLink *link = &netplay->link;
+    link->delay_ms = delay_ms;
+    link->jitter_ms = jitter_ms;
+    link->loss_percent = loss_percent;
+    link->random = seed ? seed : 1;
+}
+
+static uint64_t link_random(NetplayLink *link)
+{
+    link->random ^= link->random << 13;
+    link->random ^= link->random >> 7;
+    link->random ^= link->random << 17;
+    return link->random;
+}
+
+// Sends now, or holds the packet back on an impaired link.
+static void link_send(Netplay *netplay, const uint8_t *data, int size, uint64_t now_ns)
+{
+    NetplayLink *link = &netplay->link;
+    netplay->stats.packets_sent++;
+    if (link->loss_percent && (int)(link_random(link) % 100) < link->loss_percent) {
+        netplay->stats.packets_dropped++;
+        return;
+    }
+    if (!link->delay_ms && !link->jitter_ms) {
+        sendto(netplay->fd, data, size, 0, (struct sockaddr *)&netplay->peer, sizeof(netplay->peer));
+        return;
+    }
+    if (link->queued == NETPLAY_LINK_QUEUE) {
+        netplay->stats.packets_dropped++;
+        return;
+    }
+    uint64_t delay_ms = link->delay_ms + link_random(link) % (link->jitter_ms + 1);
+    link->queue[link->queued].due_ns = now_ns + delay_ms * 1000000;
+    link->queue[link->queued].size = size;
+    memcpy(link->queue[link->queued].data, data, size);
+    link->queued++;
+}
+
+// Sends the held-back packets that are due; jitter may reorder them.
+static void link_flush(Netplay *netplay, uint64_t now_ns)
+{
+    NetplayLink *link = &netplay->link;
+    for (int i = 0; i < link->queued; ) {
+        if (link->queue[i].due_ns > now_ns) {
+            i++;
+            continue;
+        }
+        sendto(netplay->fd, link->queue[i].data, link->queue[i].size, 0,
+               (struct sockaddr *)&netplay->peer, sizeof(netplay->peer));
+        link->queue[i] = link->queue[--link->queued];
+    }
+}
+
+static uint16_t predicted_input(const Netplay *netplay)
+{
+    if (netplay->remote_confirmed == 0) {
+        return 0;
+    }
+    return netplay->remote_inputs[(netplay->remote_confirmed - 1) % NETPLAY_HISTORY];
+}
+
+static void send_inputs(Netplay *netplay, uint64_t now_ns)
+{
+    uint8_t packet[NETPLAY_PACKET_SIZE];
+    uint32_t first = netplay->remote_acked;
+    if (netplay->frame - first > NETPLAY_HISTORY) {
+        first = netplay->frame - NETPLAY_HISTORY;
+    }
+    uint32_t count = netplay->frame - first;
+    uint32_t check_frame = NO_FRAME;
+    uint64_t check_hash = 0;
+    if (netplay->check_count) {
+        int latest = (netplay->check_count - 1) % NETPLAY_CHECKS;
+        check_frame = netplay->check_frames[latest];
+        check_hash = netplay->check_hashes[latest];
+    }
+
+    put_u32(packet, NETPLAY_MAGIC);
+    packet[4] = NETPLAY_VERSION;
+    packet[5] = 0;
+    put_u16(packet + 6, count);
+    put_u64(packet + 8, netplay->rom_hash);
+    put_u32(packet + 16, netplay->cpu_freq);
+    put_u32(packet + 20, netplay->frame);
+    put_u32(packet + 24, netplay->remote_frame);
+    put_u32(packet + 28, netplay->remote_confirmed);
+    put_u32(packet + 32, check_frame);
+    put_u64(packet + 36, check_hash);
+    put_u32(packet + 44, first);
+    for (uint32_t i = 0; i < count; i++) {
+        put_u16(packet + NETPLAY_HEADER_SIZE + 2 * i, netplay->local_inputs[(first + i) % NETPLAY_HISTORY]);
+    }
+    link_send(netplay, packet, NETPLAY_HEADER_SIZE + 2 * count, now_ns);
+}
+
+static void compare_check(Netplay *netplay, uint32_t frame, uint64_t hash)
+{
+    if (frame == NO_FRAME || frame == netplay->compared_check) {
+        return;
+    }
+    for (int i = 0; i < NETPLAY_CHECKS && i < netplay->check_count; i++) {
+        if (netplay->check_frames[i] == frame) {
+            netplay->compared_check = frame;
+            netplay->stats.checks++;
+            if (netplay->check_hashes[i] != hash) {
+                if (!netplay->stats.desyncs) {
+                    fprintf(stderr, "netplay: peers diverged by frame %u\n", frame);
+                }
+                netplay->stats.desyncs++;
+            }
+            return;
+        }
+    }
+}
+
+static void handle_packet(Netplay *netplay, const uint8_t *packet, int size)
+{
+    if (size < NETPLAY_HEADER_SIZE || get_u32(packet) != NETPLAY_MAGIC || packet[4] != NETPLAY_VERSION) {
+        netplay->stats.packets_rejected++;
+        return;
+    }
+    uint32_t count = get_u16(packet + 6);
+    if (count > NETPLAY_HISTORY || size != NETPLAY_HEADER_SIZE + 2 * (int)count ||
+        get_u64(packet + 8) != netplay->rom_hash || (int)get_u32(packet + 16) != netplay->cpu_freq) {
+        if (!netplay->stats.packets_rejected) {
+            fprintf(stderr, "netplay: ignoring a peer with a different ROM or speed\n");
+        }
+        netplay->stats.packets_rejected++;
+        return;
+    }
+    netplay->stats.packets_received++;
+
+    uint32_t sender_frame = get_u32(packet + 20);
+    if ((int32_t)(sender_frame - netplay->remote_frame) > 0) {
+        netplay->remote_frame = sender_frame;
+        netplay->remote_advantage = (int32_t)(sender_frame - get_u32(packet + 24));
+    }
+    uint32_t ack = get_u32(packet + 28);
+    if ((int32_t)(ack - netplay->remote_acked) > 0 && ack <= netplay->frame) {
+        netplay->remote_acked = ack;
+    }
+    compare_check(netplay, get_u32(packet + 32), get_u64(packet + 36));
+
+    // take inputs in order; anything past a gap comes again in a later packet
+    uint32_t first = get_u32(packet + 44);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t frame = first + i;
+        if (frame != netplay->remote_confirmed) {
+            continue;
+        }
+        // don't overwrite a slot still needed for a rollback
+        if (frame >= netplay->frame + NETPLAY_HISTORY - NETPLAY_MAX_ROLLBACK) {
+            break;
+        }
+        uint16_t keys = get_u16(packet + NETPLAY_HEADER_SIZE + 2 * i);
+        uint16_t *slot = &netplay->remote_inputs[frame % NETPLAY_HISTORY];
+        if (frame < netplay->frame && *slot != keys && frame < netplay->rollback_from) {
+            netplay->rollback_from = frame;
+        }
+        *slot = keys;
+        netplay->remote_confirmed++;
+    }
+}
+
+static void receive(Netplay *netplay)
+{
+    uint8_t packet[NETPLAY_PACKET_SIZE + 1];
+    for (;;) {
+        ssize_t size = recv(netplay->fd, packet, sizeof(packet), 0);
+        if (size < 0) {
+            return; // EAGAIN, or an ICMP error for a peer that isn't up yet
+        }
+        handle_packet(netplay, packet, (int)size);
+    }
+}
+
+// Restores the first mispredicted frame and runs forward again with what is
+// now known, predicting afresh from the newest confirmed input.
+static void roll_back(Netplay *netplay, CHIP8 *chip8)
+{
+    uint32_t from = netplay->rollback_from;
+    netplay->rollback_from = NO_FRAME;
+    if (from >= netplay->frame) {
+        return;
+    }
+    *chip8 = netplay->snapshots[from % NETPLAY_HISTORY];
+    uint16_t prediction = predicted_input(netplay);
+    for (uint32_t frame = from; frame < netplay->frame; frame++) {
+        int slot = frame % NETPLAY_HISTORY;
+        if (frame >= netplay->remote_confirmed) {
+            netplay->remote_inputs[slot] = prediction;
+        }
+        netplay->snapshots[slot] = *chip8;
+        NetplayRunFrame(chip8, frame, netplay->cpu_freq, netplay->local_inputs[slot] | netplay->remote_inputs[slot]);
+    }
+    int depth = netplay->frame - from;
+    netplay->stats.rollbacks++;
+    netplay->stats.rollback_frames += depth;
+    if (depth > netplay->stats.max_rollback) {
+        netplay->stats.max_rollback = depth;
+    }
+}
+
+// Hashes the newest snapshot that no longer depends on a prediction, every
+// NETPLAY_CHECK_INTERVAL frames.
+static void record_check(Netplay *netplay)
+{
+    if (netplay->frame == 0) {
+        return;
+    }
+    uint32_t settled = netplay->remote_confirmed < netplay->frame ? netplay->remote_confirmed : netplay->frame - 1;
+    uint32_t frame = settled - settled % NETPLAY_CHECK_INTERVAL;
+    if (netplay->frame - frame > NETPLAY_HISTORY) {
+        return; // long gone from the snapshot ring
+    }
+    if (netplay->check_count && netplay->check_frames[(netplay->check_count - 1) % NETPLAY_CHECKS] == frame) {
+        return;
+    }
+    int slot = netplay->check_count++ % NETPLAY_CHECKS;
+    netplay->check_frames[slot] = frame;
+    netplay->check_hashes[slot] = NetplayStateHash(&netplay->snapshots[frame % NETPLAY_HISTORY]);
+}
+
+void NetplayPoll(Netplay *netplay, CHIP8 *chip8, uint64_t now_ns)
+{
+    link_flush(netplay, now_ns);
+    receive(netplay);
+    roll_back(netplay, chip8);
+    record_check(netplay);
+    send_inputs(netplay, now_ns);
+}
+
+bool NetplayAdvance(Netplay *netplay, CHIP8 *chip8, uint16_t local_keys, uint64_t now_ns)
+{
+    link_flush(netplay, now_ns);
+    receive(netplay);
+    roll_back(netplay, chip8);
+    record_check(netplay);
+
+    // Wait when a prediction would reach too far back, and now and then
+    // when this peer keeps running ahead, so the other side's inputs arrive
+    // about when they are needed instead of always late.
+    int advantage = (int32_t)(netplay->frame - netplay->remote_frame);
+    bool ahead = netplay->sync_wait == 0 && (advantage - netplay->remote_advantage) / 2 >= 1;
+    if (netplay->frame - netplay->remote_confirmed >= NETPLAY_MAX_ROLLBACK || ahead) {
+        if (ahead) {
+            netplay->sync_wait = FRAME_RATE / 4;
+        }
+        netplay->stats.stalls++;
+        send_inputs(netplay, now_ns);
+        return false;
+    }
+
+    int slot = netplay->frame % NETPLAY_HISTORY;
+    netplay->local_inputs[slot] = local_keys;
+    if (netplay->frame >= netplay->remote_confirmed) {
+        netplay->remote_inputs[slot] = predicted_input(netplay);
+    }
+    netplay->snapshots[slot] = *chip8;
+    NetplayRunFrame(chip8, netplay->frame, netplay->cpu_freq, local_keys | netplay->remote_inputs[slot]);
+    netplay->frame++;
+    netplay->stats.frames++;
+    if (netplay->sync_wait) {
+        netplay->sync_wait--;
+    }
+    send_inputs(netplay, now_ns);
+    return true;
+}
+
+void NetplayRunFrame(CHIP8 *chip8, uint32_t frame, int cpu_freq, uint16_t keys)
+{
+    struct Debugger *debugger = chip8->debugger;
+    chip8->debugger = NULL;
+    UpdateKeypad(chip8, keys);
+    RunCycles(chip8, (int)(((uint64_t)frame + 1) * cpu_freq / FRAME_RATE - (uint64_t)frame * cpu_freq / FRAME_RATE));
+    UpdateTimers(chip8);
+    chip8->debugger = debugger;
+}
+
+uint64_t NetplayStateHash(const CHIP8 *chip8)
+{
+    uint64_t hash = HASH_SEED;
+    hash = HashBytes(hash, chip8->registers, sizeof(chip8->registers));
+    hash = HashBytes(hash, chip8->screen, sizeof(chip8->screen));
+    hash = HashBytes(hash, chip8->stack, sizeof(chip8->stack));
+    hash = HashBytes(hash, chip8->ram, sizeof(chip8->ram));
+    hash = HashBytes(hash, chip8->keypad, sizeof(chip8->keypad));
+    hash = HashBytes(hash, chip8->prev_keypad, sizeof(chip8->prev_keypad));
+    uint16_t words[] = {
+        chip8->index, chip8->program_counter, chip8->stack_pointer,
+        chip8->delay_timer, chip8->sound_timer,
+        chip8->random_state & 0xFFFF, chip8->random_state >> 16,
+    };
+    return HashBytes(hash, words, sizeof(words));
+}
@@ -0,0 +1,116 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#include "CHIP8.h"
+
+// Two-player rollback netplay over UDP. Both peers run the whole machine
+// locally and feed it the OR of both keypads, one mask per 60 Hz frame. The
+// remote keypad is predicted (it is assumed to still hold what it last did)
+// until its real input arrives; if that differs, the machine is restored
+// from the snapshot taken at the start of the first mispredicted frame and
+// those frames are run again. The core is deterministic (RND is seeded state
+// in CHIP8) and a snapshot is a plain struct copy, so a rollback costs a copy
+// plus the re-run frames.
+//
+// Every packet carries all local inputs the peer has not acknowledged, so a
+// lost packet is covered by the next one without retransmission timers.
+//
+//   u32 magic, u8 version, u8 reserved, u16 input count, u64 ROM hash,
+//   u32 cycles per second, u32 sender frame, u32 sender's view of our frame,
+//   u32 ack (sender has our inputs below this frame),
+//   u32 check frame, u64 state hash at that frame,
+//   u32 first input frame, u16 inputs[count]
+//
+// All integers are little endian.
+
+#define NETPLAY_MAGIC 0x504E3843 // "C8NP"
+#define NETPLAY_VERSION 1
+#define NETPLAY_MAX_ROLLBACK 8   // frames a peer runs ahead of the remote input it has
+#define NETPLAY_HISTORY 32       // frames of inputs and snapshots kept, a power of two
+#define NETPLAY_CHECK_INTERVAL 60 // frames between state hashes compared for desyncs
+#define NETPLAY_CHECKS 8
+#define NETPLAY_HEADER_SIZE 48
+#define NETPLAY_PACKET_SIZE (NETPLAY_HEADER_SIZE + 2 * NETPLAY_HISTORY)
+#define NETPLAY_LINK_QUEUE 256   // packets an impaired link can hold back
+
+// Artificial delay and loss on outgoing packets, for testing on one machine.
+typedef struct {
+    int delay_ms;
+    int jitter_ms;           // extra delay, uniform in [0, jitter_ms]
+    int loss_percent;
+    uint64_t random;         // xorshift64 state
+    struct {
+        uint64_t due_ns;
+        int size;
+        uint8_t data[NETPLAY_PACKET_SIZE];
+    } queue[NETPLAY_LINK_QUEUE];
+    int queued;
+} NetplayLink;
+
+typedef struct {
+    uint64_t frames;         // frames advanced
+    uint64_t stalls;         // ticks spent waiting for the peer
+    uint64_t rollbacks;
+    uint64_t rollback_frames; // frames run again
+    int max_rollback;
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t packets_dropped; // by the impaired link
+    uint64_t packets_rejected; // wrong ROM, speed or format
+    uint64_t checks;         // state hashes compared
+    uint64_t desyncs;        // ... that differed
+} NetplayStats;
+
+typedef struct {
+    int fd;
+    struct sockaddr_in peer;
+    uint64_t rom_hash;
+    int cpu_freq;
+
+    uint32_t frame;          // next frame to run
+    uint32_t remote_confirmed; // remote inputs are known below this frame
+    uint32_t remote_acked;   // the peer has our inputs below this frame
+    uint32_t remote_frame;   // the peer's frame, as last reported
+    int remote_advantage;    // how far the peer thinks it is ahead of us
+    uint32_t rollback_from;  // first mispredicted frame, UINT32_MAX if none
+    uint32_t sync_wait;      // frames until the next time-sync stall is allowed
+
+    uint16_t local_inputs[NETPLAY_HISTORY];
+    uint16_t remote_inputs[NETPLAY_HISTORY]; // predicted at and above remote_confirmed
+    CHIP8 snapshots[NETPLAY_HISTORY];        // state at the start of each frame
+
+    uint32_t check_frames[NETPLAY_CHECKS];   // our recent state hashes
+    uint64_t check_hashes[NETPLAY_CHECKS];
+    int check_count;
+    uint32_t compared_check; // last remote check compared, UINT32_MAX if none
+
+    NetplayLink link;
+    NetplayStats stats;
+} Netplay;
+
+// Binds `local_port` on all interfaces and sends to `peer_host`:`peer_port`.
+// Both peers must load the same ROM and run at the same speed.
+bool NetplayOpen(Netplay *netplay, int local_port, const char *peer_host, int peer_port,
+                 uint64_t rom_hash, int cpu_freq);
+void NetplayClose(Netplay *netplay);
+void NetplaySetLink(Netplay *netplay, int delay_ms, int jitter_ms, int loss_percent, uint64_t seed);
+
+// Runs one frame tick: takes in the peer's packets, rolls back and replays
+// mispredicted frames, then runs the next frame with `local_keys` unless this
+// peer is too far ahead, and sends our inputs. Returns false if it waited
+// instead of running a frame. `now_ns` drives the artificial link delay.
+bool NetplayAdvance(Netplay *netplay, CHIP8 *chip8, uint16_t local_keys, uint64_t now_ns);
+// Takes in packets and corrects mispredictions without running a new frame.
+void NetplayPoll(Netplay *netplay, CHIP8 *chip8, uint64_t now_ns);
+// Runs one frame of the machine the way every peer does. Always the whole
+// frame: breakpoints and watchpoints are ignored, since a stop partway
+// would leave the next snapshot between instructions of a frame.
+void NetplayRunFrame(CHIP8 *chip8, uint32_t frame, int cpu_freq, uint16_t keys);
+// Hash of everything a ROM can observe, for desync checks.
+uint64_t NetplayStateHash(const CHIP8 *chip8);
+
+#endif
@@ -0,0 +1,127 @@
+#include "opcodes.h"
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+
+#define MNEMONIC_SLOTS 64 // power of two, comfortably above the mnemonic count
+
+#define OPCODE_INFO(name, mask, pattern, mnemonic, operands, writes) { mnemonic, operands, mask, pattern, writes },
+const OpcodeInfo Opcodes[OP_COUNT] = {
+    [OP_INVALID] = { "", "", 0x0000, 0xFFFF, 0 },
+    CHIP8_OPCODES(OPCODE_INFO)
+};
+#undef OPCODE_INFO
+
+uint8_t OpcodeTable[65536];
+
+static once_flag opcodes_once = ONCE_FLAG_INIT;
+static uint8_t next_form[OP_COUNT];
+static uint8_t mnemonic_slots[MNEMONIC_SLOTS];
+static uint32_t mnemonic_seed;
+
+static uint32_t hash_mnemonic(const char *mnemonic, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    for (const char *c = mnemonic; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return hash & (MNEMONIC_SLOTS - 1);
+}
+
+// Searches for a seed that gives every distinct mnemonic its own slot, so a
+// lookup is one hash and one strcmp.
+static void build_mnemonic_hash(void)
+{
+    for (mnemonic_seed = 0;; mnemonic_seed++) {
+        memset(mnemonic_slots, OP_INVALID, sizeof(mnemonic_slots));
+        bool collision = false;
+        for (int op = OP_INVALID + 1; op < OP_COUNT && !collision; op++) {
+            uint8_t *slot = &mnemonic_slots[hash_mnemonic(Opcodes[op].mnemonic, mnemonic_seed)];
+            if (*slot == OP_INVALID) {
+                *slot = op;
+            } else if (strcmp(Opcodes[*slot].mnemonic, Opcodes[op].mnemonic) != 0) {
+                collision = true;
+            }
+        }
+        if (!collision) {
+            return;
+        }
+    }
+}
+
+static void build_tables(void)
+{
+    memset(OpcodeTable, OP_INVALID, sizeof(OpcodeTable));
+    for (uint32_t raw = 0; raw < 65536; raw++) {
+        for (int op = OP_INVALID + 1; op < OP_COUNT; op++) {
+            if ((raw & Opcodes[op].mask) == Opcodes[op].pattern) {
+                OpcodeTable[raw] = op;
+                break;
+            }
+        }
+    }
+    for (int op = OP_INVALID + 1; op < OP_COUNT; op++) {
+        next_form[op] = OP_INVALID;
+        for (int later = op + 1; later < OP_COUNT; later++) {
+            if (strcmp(Opcodes[op].mnemonic, Opcodes[later].mnemonic) == 0) {
+                next_form[op] = later;
+                break;
+            }
+        }
+    }
+    build_mnemonic_hash();
+}
+
+void InitializeOpcodes(void)
+{
+    call_once(&opcodes_once, build_tables);
+}
+
+bool FormatInstruction(Instruction instruction, char *buffer, size_t buffer_size)
+{
+    InitializeOpcodes();
+    Opcode op = DecodeOpcode(instruction.raw);
+    if (op == OP_INVALID) {
+        return false;
+    }
+    int n = snprintf(buffer, buffer_size, "%s", Opcodes[op].mnemonic);
+    const char *operand = Opcodes[op].operands;
+    for (int i = 0; *operand && n >= 0 && (size_t)n < buffer_size; i++) {
+        size_t length = strcspn(operand, ",");
+        char field[8];
+        snprintf(field, sizeof(field), "%.*s", (int)length, operand);
+
+        const char *separator = i == 0 ? " " : ", ";
+        if (strcmp(field, "Vx") == 0) {
+            n += snprintf(buffer + n, buffer_size - n, "%sV%X", separator, instruction.nibbles.x);
+        } else if (strcmp(field, "Vy") == 0) {
+            n += snprintf(buffer + n, buffer_size - n, "%sV%X", separator, instruction.nibbles.y);
+        } else if (strcmp(field, "n") == 0) {
+            n += snprintf(buffer + n, buffer_size - n, "%s0x%X", separator, instruction.nibbles.n);
+        } else if (strcmp(field, "nn") == 0) {
+            n += snprintf(buffer + n, buffer_size - n, "%s0x%02X", separator, instruction.type6.nn);
+        } else if (strcmp(field, "nnn") == 0) {
+            n += snprintf(buffer + n, buffer_size - n, "%s0x%03X", separator, instruction.addr.nnn);
+        } else {
+            n += snprintf(buffer + n, buffer_size - n, "%s%s", separator, field);
+        }
+        operand += length;
+        operand += strspn(operand, ", ");
+    }
+    return n >= 0 && (size_t)n < buffer_size;
+}
+
+Opcode LookupMnemonic(const char *mnemonic)
+{
+    InitializeOpcodes();
+    uint8_t op = mnemonic_slots[hash_mnemonic(mnemonic, mnemonic_seed)];
+    if (op == OP_INVALID || strcmp(Opcodes[op].mnemonic, mnemonic) != 0) {
+        return OP_INVALID;
+    }
+    return (Opcode)op;
+}
+
+Opcode NextOpcodeForm(Opcode opcode)
+{
+    return (Opcode)next_form[opcode];
+}
@@ -0,0 +1,132 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef union {
+    uint16_t raw;
+
+    struct {
+        uint16_t n : 4;
+        uint16_t y : 4;
+        uint16_t x : 4;
+        uint16_t : 4;
+    } nibbles;
+
+    struct {
+        uint16_t nn : 8;
+        uint16_t x : 4;
+        uint16_t : 4;
+    } type6;
+
+    struct {
+        uint16_t nnn : 12;
+        uint16_t : 4;
+    } addr;
+
+    struct {
+        uint16_t : 12;
+        uint16_t opcode : 4;
+    };
+
+} Instruction;
+
+// The one description of the instruction set. The decoder, the disassembler
+// and the assembler are all generated from it.
+//
+// X(name, mask, pattern, mnemonic, operands, writes): an opcode matches an
+// entry when (opcode & mask) == pattern, first entry wins. In the operand list
+// Vx, Vy, n, nn and nnn are instruction fields, anything else is a literal.
+// Fields may overlap: BXNN jumps to XNN + VX, so in JP Vx, nnn the register
+// is the first digit of the address.
+// `writes` is the registers the instruction may change. The tracer works
+// them out again by running the instruction on its own copy of the
+// registers, unless WR_INPUT says the result comes from somewhere else.
+enum {
+    WR_VX = 1 << 0,
+    WR_VF = 1 << 1,
+    WR_V0_VX = 1 << 2, // V0 through Vx
+    WR_I = 1 << 3,
+    WR_INPUT = 1 << 4, // RNG, timer, keypad, screen or RAM: captured as it runs
+};
+
+#define CHIP8_OPCODES(X) \
+    X(CLS,       0xFFFF, 0x00E0, "CLS",  "",          0)                    \
+    X(RET,       0xFFFF, 0x00EE, "RET",  "",          0)                    \
+    X(JP,        0xF000, 0x1000, "JP",   "nnn",       0)                    \
+    X(CALL,      0xF000, 0x2000, "CALL", "nnn",       0)                    \
+    X(SE_BYTE,   0xF000, 0x3000, "SE",   "Vx, nn",    0)                    \
+    X(SNE_BYTE,  0xF000, 0x4000, "SNE",  "Vx, nn",    0)                    \
+    X(SE_REG,    0xF000, 0x5000, "SE",   "Vx, Vy",    0)                    \
+    X(LD_BYTE,   0xF000, 0x6000, "LD",   "Vx, nn",    WR_VX)                \
+    X(ADD_BYTE,  0xF000, 0x7000, "ADD",  "Vx, nn",    WR_VX)                \
+    X(LD_REG,    0xF00F, 0x8000, "LD",   "Vx, Vy",    WR_VX)                \
+    X(OR,        0xF00F, 0x8001, "OR",   "Vx, Vy",    WR_VX)                \
+    X(AND,       0xF00F, 0x8002, "AND",  "Vx, Vy",    WR_VX)                \
+    X(XOR,       0xF00F, 0x8003, "XOR",  "Vx, Vy",    WR_VX)                \
+    X(ADD_REG,   0xF00F, 0x8004, "ADD",  "Vx, Vy",    WR_VX | WR_VF)        \
+    X(SUB,       0xF00F, 0x8005, "SUB",  "Vx, Vy",    WR_VX | WR_VF)        \
+    X(SHR,       0xF00F, 0x8006, "SHR",  "Vx",        WR_VX | WR_VF)        \
+    X(SUBN,      0xF00F, 0x8007, "SUBN", "Vx, Vy",    WR_VX | WR_VF)        \
+    X(SHL,       0xF00F, 0x800E, "SHL",  "Vx",        WR_VX | WR_VF)        \
+    X(SNE_REG,   0xF000, 0x9000, "SNE",  "Vx, Vy",    0)                    \
+    X(LD_I,      0xF000, 0xA000, "LD",   "I, nnn",    WR_I)                 \
+    X(JP_VX,     0xF000, 0xB000, "JP",   "Vx, nnn",   0)                    \
+    X(RND,       0xF000, 0xC000, "RND",  "Vx, nn",    WR_VX | WR_INPUT)     \
+    X(DRW,       0xF000, 0xD000, "DRW",  "Vx, Vy, n", WR_VF | WR_INPUT)     \
+    X(SKP,       0xF0FF, 0xE09E, "SKP",  "Vx",        0)                    \
+    X(SKNP,      0xF0FF, 0xE0A1, "SKNP", "Vx",        0)                    \
+    X(LD_VX_DT,  0xF0FF, 0xF007, "LD",   "Vx, DT",    WR_VX | WR_INPUT)     \
+    X(LD_VX_K,   0xF0FF, 0xF00A, "LD",   "Vx, K",     WR_VX | WR_INPUT)     \
+    X(LD_DT_VX,  0xF0FF, 0xF015, "LD",   "DT, Vx",    0)                    \
+    X(LD_ST_VX,  0xF0FF, 0xF018, "LD",   "ST, Vx",    0)                    \
+    X(ADD_I_VX,  0xF0FF, 0xF01E, "ADD",  "I, Vx",     WR_I)                 \
+    X(LD_F_VX,   0xF0FF, 0xF029, "LD",   "F, Vx",     WR_I)                 \
+    X(LD_B_VX,   0xF0FF, 0xF033, "LD",   "B, Vx",     0)                    \
+    X(LD_MEM_VX, 0xF0FF, 0xF055, "LD",   "[I], Vx",   0)                    \
+    X(LD_VX_MEM, 0xF0FF, 0xF065, "LD",   "Vx, [I]",   WR_V0_VX | WR_INPUT)
+
+#define OPCODE_ENUM(name, mask, pattern, mnemonic, operands, writes) OP_##name,
+typedef enum {
+    OP_INVALID, // zero, so a decode table that hasn't been built yet decodes nothing
+    CHIP8_OPCODES(OPCODE_ENUM)
+    OP_COUNT,
+} Opcode;
+#undef OPCODE_ENUM
+
+typedef struct {
+    const char *mnemonic;
+    const char *operands;
+    uint16_t mask;
+    uint16_t pattern;
+    uint8_t writes;
+} OpcodeInfo;
+
+// Indexed by Opcode. The OP_INVALID entry is blank and matches no word.
+extern const OpcodeInfo Opcodes[OP_COUNT];
+
+// Every 16-bit word mapped to its Opcode, OP_INVALID when nothing matches
+// or before InitializeOpcodes has run.
+extern uint8_t OpcodeTable[65536];
+
+// Builds the decode and mnemonic tables; safe to call from any thread, any
+// number of times. InitializeCHIP8 calls it.
+void InitializeOpcodes(void);
+
+static inline Opcode DecodeOpcode(uint16_t raw)
+{
+    return (Opcode)OpcodeTable[raw];
+}
+
+// Writes the assembler spelling of `instruction`. Returns false for words
+// that are not instructions.
+bool FormatInstruction(Instruction instruction, char *buffer, size_t buffer_size);
+
+// First opcode spelled `mnemonic`, or OP_INVALID. Opcodes that share a
+// mnemonic (LD, ADD, SE, ...) are chained through NextOpcodeForm.
+Opcode LookupMnemonic(const char *mnemonic);
+Opcode NextOpcodeForm(Opcode opcode);
+
+#endif
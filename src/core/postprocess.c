@@ -0,0 +1,278 @@
+#include "postprocess.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define POSTPROCESS_X86
+#include <immintrin.h>
+#endif
+
+#define MAX_SCALE 32
+#define ROW_SLACK 4          // filling a row may write one vector past its end
+#define COLUMN_BITS 0x0102040810204080ULL // lane i of a byte tests bit 7 - i
+
+static const struct {
+    const char *name;
+    Palette palette;
+} presets[] = {
+    { "white", { 0x000000, 0xFFFFFF } },
+    { "amber", { 0x140C00, 0xFFB000 } },
+    { "green", { 0x001400, 0x33FF66 } },
+    { "lcd",   { 0x0F380F, 0x9BBC0F } },
+};
+
+static void expand_scalar(const uint64_t *screen, uint8_t glow[32][64])
+{
+    for (int row = 0; row < 32; row++) {
+        for (int col = 0; col < 64; col++) {
+            glow[row][col] = (screen[row] >> (63 - col) & 1) ? 0xFF : 0;
+        }
+    }
+}
+
+#ifdef POSTPROCESS_X86
+// Column 0 is the top bit of a row, so after a byte swap the bytes are in
+// column order. Each byte is spread over eight lanes, each lane keeps its
+// own bit, and comparing against the bit gives 0xFF or 0x00.
+static void expand_sse2(const uint64_t *screen, uint8_t glow[32][64])
+{
+    const __m128i bits = _mm_set1_epi64x(COLUMN_BITS);
+    for (int row = 0; row < 32; row++) {
+        uint64_t columns = __builtin_bswap64(screen[row]);
+        for (int i = 0; i < 4; i++) {
+            __m128i v = _mm_cvtsi32_si128((uint16_t)(columns >> 16 * i));
+            v = _mm_unpacklo_epi8(v, v);
+            v = _mm_unpacklo_epi16(v, v);
+            v = _mm_unpacklo_epi32(v, v); // first byte in lanes 0-7, second in 8-15
+            v = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+            _mm_storeu_si128((__m128i *)&glow[row][16 * i], v);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void expand_avx2(const uint64_t *screen, uint8_t glow[32][64])
+{
+    const __m256i bits = _mm256_set1_epi64x(COLUMN_BITS);
+    const __m256i spread = _mm256_setr_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+        2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    for (int row = 0; row < 32; row++) {
+        uint64_t columns = __builtin_bswap64(screen[row]);
+        for (int i = 0; i < 2; i++) {
+            __m256i v = _mm256_set1_epi32((uint32_t)(columns >> 32 * i));
+            v = _mm256_shuffle_epi8(v, spread);
+            v = _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits);
+            _mm256_storeu_si256((__m256i *)&glow[row][32 * i], v);
+        }
+    }
+}
+#endif
+
+// glow = max(lit, glow * keep / 256); returns true if any pixel is neither
+// fully lit nor dark.
+static bool fade(uint8_t glow[32][64], uint8_t lit[32][64], int keep)
+{
+    uint8_t *g = &glow[0][0], *l = &lit[0][0];
+#ifdef POSTPROCESS_X86
+    const __m128i zero = _mm_setzero_si128(), full = _mm_set1_epi8(-1);
+    const __m128i factor = _mm_set1_epi16(keep);
+    int settled = 0xFFFF;
+    for (int i = 0; i < 32 * 64; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(g + i));
+        __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), factor), 8);
+        __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), factor), 8);
+        v = _mm_max_epu8(_mm_packus_epi16(lo, hi), _mm_loadu_si128((const __m128i *)(l + i)));
+        _mm_storeu_si128((__m128i *)(g + i), v);
+        settled &= _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, full)));
+    }
+    return settled != 0xFFFF;
+#else
+    bool fading = false;
+    for (int i = 0; i < 32 * 64; i++) {
+        int v = g[i] * keep >> 8;
+        g[i] = l[i] > v ? l[i] : v;
+        fading |= g[i] != 0 && g[i] != 0xFF;
+    }
+    return fading;
+#endif
+}
+
+// Scale2x/EPX: each pixel becomes four, and a corner takes the colour of
+// its two neighbours when they agree and the other two don't.
+static void epx(const uint8_t glow[32][64], uint8_t *out)
+{
+    for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 64; x++) {
+            uint8_t p = glow[y][x];
+            uint8_t a = y > 0 ? glow[y - 1][x] : p;
+            uint8_t b = x < 63 ? glow[y][x + 1] : p;
+            uint8_t c = x > 0 ? glow[y][x - 1] : p;
+            uint8_t d = y < 31 ? glow[y + 1][x] : p;
+            uint8_t *top = out + 2 * y * 128 + 2 * x, *bottom = top + 128;
+            top[0] = c == a && c != d && a != b ? a : p;
+            top[1] = a == b && a != c && b != d ? b : p;
+            bottom[0] = d == c && d != b && c != a ? c : p;
+            bottom[1] = b == d && b != a && d != c ? d : p;
+        }
+    }
+}
+
+// One output row: every source pixel repeated `factor` times.
+static void fill_row(uint32_t *dst, const uint8_t *src, int count, int factor, const uint32_t *colors)
+{
+#ifdef POSTPROCESS_X86
+    for (int i = 0; i < count; i++, dst += factor) {
+        __m128i color = _mm_set1_epi32(colors[src[i]]);
+        for (int k = 0; k < factor; k += 4) {
+            _mm_storeu_si128((__m128i *)(dst + k), color);
+        }
+    }
+#else
+    for (int i = 0; i < count; i++, dst += factor) {
+        for (int k = 0; k < factor; k++) {
+            dst[k] = colors[src[i]];
+        }
+    }
+#endif
+}
+
+// Half brightness, alpha kept.
+static void dim_row(uint32_t *dst, const uint32_t *src, int count)
+{
+    int i = 0;
+#ifdef POSTPROCESS_X86
+    const __m128i mask = _mm_set1_epi32(0x7F7F7F7F), alpha = _mm_set1_epi32((int)0xFF000000);
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 1), mask), alpha);
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = (src[i] >> 1 & 0x7F7F7F7F) | 0xFF000000;
+    }
+}
+
+bool PostProcessInit(PostProcess *post)
+{
+    if (post->scale < 1 || post->scale > MAX_SCALE) {
+        fprintf(stderr, "Scale must be between 1 and %d\n", MAX_SCALE);
+        return false;
+    }
+    if (post->scaler == SCALER_EPX && post->scale % 2) {
+        fprintf(stderr, "EPX needs an even scale\n");
+        return false;
+    }
+    if (post->persistence < 0 || post->persistence > 100) {
+        fprintf(stderr, "Phosphor persistence is a percentage\n");
+        return false;
+    }
+    post->width = 64 * post->scale;
+    post->height = 32 * post->scale;
+    post->pixels = calloc((size_t)post->width * post->height + ROW_SLACK, sizeof(uint32_t));
+    post->scaled = post->scaler == SCALER_EPX ? malloc(128 * 64) : NULL;
+    if (!post->pixels || (post->scaler == SCALER_EPX && !post->scaled)) {
+        PostProcessFree(post);
+        return false;
+    }
+    memset(post->glow, 0, sizeof(post->glow));
+
+    for (int v = 0; v < 256; v++) {
+        uint32_t color = 0xFF000000;
+        for (int shift = 0; shift < 24; shift += 8) {
+            int from = post->palette.background >> shift & 0xFF, to = post->palette.foreground >> shift & 0xFF;
+            color |= (uint32_t)(from + (to - from) * v / 255) << shift;
+        }
+        post->colors[v] = color;
+    }
+
+    post->expand = expand_scalar;
+#ifdef POSTPROCESS_X86
+    post->expand = __builtin_cpu_supports("avx2") ? expand_avx2 : expand_sse2;
+#endif
+    return true;
+}
+
+void PostProcessFree(PostProcess *post)
+{
+    free(post->pixels);
+    free(post->scaled);
+    post->pixels = NULL;
+    post->scaled = NULL;
+}
+
+bool PostProcessFrame(PostProcess *post, const uint64_t *screen)
+{
+    bool fading = false;
+    if (post->persistence) {
+        uint8_t lit[32][64];
+        post->expand(screen, lit);
+        fading = fade(post->glow, lit, post->persistence * 255 / 100);
+    } else {
+        post->expand(screen, post->glow);
+    }
+
+    const uint8_t *source = &post->glow[0][0];
+    int columns = 64, rows = 32, factor = post->scale;
+    if (post->scaler == SCALER_EPX) {
+        epx(post->glow, post->scaled);
+        source = post->scaled;
+        columns = 128;
+        rows = 64;
+        factor /= 2;
+    }
+
+    // bottom third of every block is a scanline, at least one row of two
+    int dim_from = post->scanlines && factor > 1 ? factor - (factor / 3 > 0 ? factor / 3 : 1) : factor;
+    for (int y = 0; y < rows; y++) {
+        uint32_t *block = post->pixels + (size_t)y * factor * post->width;
+        fill_row(block, source + y * columns, columns, factor, post->colors);
+        for (int r = 1; r < dim_from; r++) {
+            memcpy(block + r * post->width, block, post->width * sizeof(uint32_t));
+        }
+        if (dim_from < factor) {
+            uint32_t *dim = block + dim_from * post->width;
+            dim_row(dim, block, post->width);
+            for (int r = dim_from + 1; r < factor; r++) {
+                memcpy(block + r * post->width, dim, post->width * sizeof(uint32_t));
+            }
+        }
+    }
+    return fading;
+}
+
+bool PostProcessParseScaler(const char *name, Scaler *scaler)
+{
+    if (strcmp(name, "nearest") == 0) {
+        *scaler = SCALER_NEAREST;
+    } else if (strcmp(name, "epx") == 0 || strcmp(name, "scale2x") == 0) {
+        *scaler = SCALER_EPX;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool PostProcessParsePalette(const char *text, Palette *palette)
+{
+    for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+        if (strcmp(text, presets[i].name) == 0) {
+            *palette = presets[i].palette;
+            return true;
+        }
+    }
+    if (strlen(text) != 13 || text[6] != ':') {
+        return false;
+    }
+    for (int i = 0; i < 13; i++) {
+        if (i != 6 && !isxdigit((unsigned char)text[i])) {
+            return false;
+        }
+    }
+    palette->background = strtoul(text, NULL, 16);
+    palette->foreground = strtoul(text + 7, NULL, 16);
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef POSTPROCESS_H
+#define POSTPROCESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "CHIP8.h"
+
+// Turns the 1-bit screen into 32-bit pixels on the CPU, for the window's
+// streaming texture and for headless captures alike:
+//
+//   1. expand each row's bits to one byte per pixel (SSE2, or AVX2 when the
+//      CPU has it)
+//   2. phosphor persistence: a pixel that goes dark keeps a share of its glow
+//      for a few frames, which hides the flicker of XOR-drawn sprites
+//   3. scale: Scale2x/EPX doubles the image while rounding off diagonal
+//      steps, then whole pixels are repeated up to the requested size
+//   4. map glow through the palette, optionally dimming the bottom rows of
+//      every pixel like the scanlines of a CRT
+//
+// Pixels are 0xAARRGGBB in native byte order (SDL_PIXELFORMAT_ARGB8888),
+// `width` per row with no padding.
+
+typedef enum {
+    SCALER_NEAREST,
+    SCALER_EPX,              // needs an even scale
+} Scaler;
+
+typedef struct {
+    uint32_t background;     // 0xRRGGBB
+    uint32_t foreground;
+} Palette;
+
+typedef struct {
+    // settings, fixed once PostProcessInit has run
+    int scale;               // output pixels per CHIP-8 pixel
+    Scaler scaler;
+    int persistence;         // percent of its glow a pixel keeps per frame off
+    bool scanlines;
+    Palette palette;
+
+    // output
+    int width, height;
+    uint32_t *pixels;
+
+    uint8_t glow[32][64];
+    uint8_t *scaled;         // glow after EPX, twice the size in each direction
+    uint32_t colors[256];    // palette ramp indexed by glow
+    void (*expand)(const uint64_t *screen, uint8_t glow[32][64]);
+} PostProcess;
+
+// Checks the settings and allocates the output. Returns false with a
+// message on stderr if the settings don't work.
+bool PostProcessInit(PostProcess *post);
+void PostProcessFree(PostProcess *post);
+// Renders one 60 Hz frame into `pixels`. Returns true while some pixel is
+// still fading, i.e. calling it again with the same screen changes the
+// output.
+bool PostProcessFrame(PostProcess *post, const uint64_t *screen);
+
+// "nearest" or "epx".
+bool PostProcessParseScaler(const char *name, Scaler *scaler);
+// A preset name (white, amber, green, lcd) or "RRGGBB:RRGGBB", background
+// first.
+bool PostProcessParsePalette(const char *text, Palette *palette);
+
+#endif
@@ -0,0 +1,153 @@
+#define _POSIX_C_SOURCE 200809L // shm_open
+#include "stats.h"
+#include "hash.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool StatsOpen(StatsPublisher *stats, const char *rom_path, const uint8_t *rom, size_t rom_size)
+{
+    memset(stats, 0, sizeof(*stats));
+    snprintf(stats->name, sizeof(stats->name), STATS_SHM_PREFIX "%d", (int)getpid());
+    int fd = shm_open(stats->name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to create stats segment");
+        return false;
+    }
+    if (ftruncate(fd, sizeof(StatsPage)) != 0) {
+        perror("Failed to size stats segment");
+        close(fd);
+        shm_unlink(stats->name);
+        return false;
+    }
+    StatsPage *page = mmap(NULL, sizeof(StatsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        perror("Failed to map stats segment");
+        shm_unlink(stats->name);
+        return false;
+    }
+
+    page->version = STATS_VERSION;
+    page->size = sizeof(StatsPage);
+    page->pid = (int32_t)getpid();
+    page->rom_hash = HashBytes(HASH_SEED, rom, rom_size);
+    const char *base = strrchr(rom_path, '/');
+    snprintf(page->rom_name, sizeof(page->rom_name), "%s", base ? base + 1 : rom_path);
+    // readers ignore the page until the magic shows up
+    atomic_thread_fence(memory_order_release);
+    page->magic = STATS_MAGIC;
+    stats->page = page;
+    return true;
+}
+
+void StatsClose(StatsPublisher *stats)
+{
+    if (!stats->page) {
+        return;
+    }
+    munmap(stats->page, sizeof(StatsPage));
+    shm_unlink(stats->name);
+    stats->page = NULL;
+}
+
+void StatsPublishEmulation(StatsPublisher *stats, uint64_t now_ns, uint64_t instructions,
+                           const FrameHistogram *frame_times, uint64_t dropped_frames,
+                           uint64_t skipped_frames, uint64_t audio_underruns)
+{
+    StatsPage *page = stats->page;
+    if (!page) {
+        return;
+    }
+    StatsEmulation *section = &page->emulation;
+    StatsWriteBegin(&section->seq);
+    section->frames++;
+    section->instructions = instructions;
+    section->dropped_frames = dropped_frames;
+    section->skipped_frames = skipped_frames;
+    section->audio_underruns = audio_underruns;
+    if (section->frames % STATS_REFRESH == 0) {
+        if (stats->window_start_ns && now_ns > stats->window_start_ns) {
+            section->ips = (instructions - stats->window_instructions) * 1000000000ULL / (now_ns - stats->window_start_ns);
+        }
+        stats->window_start_ns = now_ns;
+        stats->window_instructions = instructions;
+        section->frame_p50_ns = HistogramPercentile(frame_times, 0.50);
+        section->frame_p99_ns = HistogramPercentile(frame_times, 0.99);
+    }
+    StatsWriteEnd(&section->seq);
+}
+
+void StatsPublishRender(StatsPublisher *stats, uint64_t draw_ns, const FrameHistogram *draw_times)
+{
+    StatsPage *page = stats->page;
+    if (!page) {
+        return;
+    }
+    StatsRender *section = &page->render;
+    StatsWriteBegin(&section->seq);
+    section->presents++;
+    section->draw_last_ns = draw_ns;
+    if (section->presents % STATS_REFRESH == 1) {
+        section->draw_p50_ns = HistogramPercentile(draw_times, 0.50);
+        section->draw_p99_ns = HistogramPercentile(draw_times, 0.99);
+    }
+    StatsWriteEnd(&section->seq);
+}
+
+const StatsPage *StatsAttach(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(StatsPage)) {
+        close(fd);
+        return NULL;
+    }
+    const StatsPage *page = mmap(NULL, sizeof(StatsPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        return NULL;
+    }
+    if (page->magic != STATS_MAGIC || page->version != STATS_VERSION) {
+        StatsDetach(page);
+        return NULL;
+    }
+    return page;
+}
+
+void StatsDetach(const StatsPage *page)
+{
+    munmap((void *)page, sizeof(StatsPage));
+}
+
+// Copies a section once no update overlaps the copy.
+static bool read_section(const atomic_uint *seq, const void *section, void *out, size_t size)
+{
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        unsigned before = atomic_load_explicit(seq, memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(out, section, size);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(seq, memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool StatsRead(const StatsPage *page, StatsEmulation *emulation, StatsRender *render)
+{
+    if (page->magic != STATS_MAGIC || page->version != STATS_VERSION) {
+        return false;
+    }
+    return read_section(&page->emulation.seq, &page->emulation, emulation, sizeof(*emulation)) &&
+           read_section(&page->render.seq, &page->render, render, sizeof(*render));
+}
@@ -0,0 +1,99 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "histogram.h"
+
+// Live counters in a POSIX shared-memory segment named STATS_SHM_PREFIX<pid>,
+// for chip8-top and anything else that wants to watch a running instance.
+//
+// Each writer thread owns one section and updates it once per frame under
+// that section's seqlock: `seq` is odd while an update is in progress, and a
+// reader retries until it sees the same even value before and after its
+// copy. Percentiles and rates are refreshed every STATS_REFRESH frames so
+// the per-frame cost stays a handful of stores.
+//
+// New fields are only ever appended; STATS_VERSION changes when existing
+// ones move or change meaning.
+
+#define STATS_MAGIC 0x54533843 // "C8ST"
+#define STATS_VERSION 1
+#define STATS_SHM_PREFIX "/chip8-stats-"
+#define STATS_SHM_DIR "/dev/shm"
+#define STATS_REFRESH 60
+
+typedef struct {
+    atomic_uint seq;
+    uint64_t frames;
+    uint64_t instructions;
+    uint64_t ips;             // instructions per second over the last refresh
+    uint64_t frame_p50_ns;    // emulation time per frame
+    uint64_t frame_p99_ns;
+    uint64_t dropped_frames;  // screens replaced before they were presented
+    uint64_t skipped_frames;  // frame ticks given up after falling behind
+    uint64_t audio_underruns; // counted by the audio callback, published here
+} StatsEmulation;
+
+typedef struct {
+    atomic_uint seq;
+    uint64_t presents;
+    uint64_t draw_last_ns;    // draw and present of the last frame
+    uint64_t draw_p50_ns;
+    uint64_t draw_p99_ns;
+} StatsRender;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;            // sizeof(StatsPage) of the writer
+    int32_t pid;
+    uint64_t rom_hash;        // FNV-1a of the ROM, as LibraryHash
+    char rom_name[64];
+    // sections sit on their own cache lines so the two writers don't share one
+    _Alignas(64) StatsEmulation emulation;
+    _Alignas(64) StatsRender render;
+} StatsPage;
+
+typedef struct {
+    StatsPage *page;          // NULL when publishing is off
+    char name[32];
+    // emulation thread only
+    uint64_t window_start_ns;
+    uint64_t window_instructions;
+} StatsPublisher;
+
+// Creates and maps the segment for this process, naming the ROM after its
+// path and hashing the loaded image the way the library does. On failure
+// the publisher stays disabled and every other call is a no-op.
+bool StatsOpen(StatsPublisher *stats, const char *rom_path, const uint8_t *rom, size_t rom_size);
+void StatsClose(StatsPublisher *stats);
+
+// Called by the emulation thread after every frame.
+void StatsPublishEmulation(StatsPublisher *stats, uint64_t now_ns, uint64_t instructions,
+                           const FrameHistogram *frame_times, uint64_t dropped_frames,
+                           uint64_t skipped_frames, uint64_t audio_underruns);
+// Called by the presenting thread after every present.
+void StatsPublishRender(StatsPublisher *stats, uint64_t draw_ns, const FrameHistogram *draw_times);
+
+// Reader side: maps another process's page read-only.
+const StatsPage *StatsAttach(const char *name);
+void StatsDetach(const StatsPage *page);
+// Consistent copies of both sections; false if the page is not one we understand.
+bool StatsRead(const StatsPage *page, StatsEmulation *emulation, StatsRender *render);
+
+static inline void StatsWriteBegin(atomic_uint *seq)
+{
+    atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void StatsWriteEnd(atomic_uint *seq)
+{
+    atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+#endif
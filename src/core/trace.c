@@ -0,0 +1,274 @@
+#define _POSIX_C_SOURCE 200809L // nanosleep
+#include "trace.h"
+#include "debugger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A step is one executed instruction as the emulation thread hands it over:
+//   bits 0-11 pc, 12-27 opcode, 28-31 STEP_*
+// A WR_INPUT instruction has the register it wrote in the value ring, or
+// for LD Vx, [I] all sixteen (two values). A STEP_SYNC step stands for no
+// instruction: it starts every batch, with the registers and then I as the
+// batch found them (three values).
+enum {
+    STEP_SYNC = 1 << 0,
+    STEP_GAP = 1 << 1, // with STEP_SYNC: instructions ran untraced before the batch
+};
+#define STEP_FLAGS(step) ((step) >> 28)
+#define SYNC_VALUES 3
+#define CAPTURE_VALUES 2 // at most, per instruction
+#define TRACE_BATCH 1024 // instructions per ring reservation
+#define STEP_SLACK (1 + TRACE_BATCH) // a batch runs past the ring's end, then wraps
+#define FLUSH_BUFFER 65536
+#define RING_MASK (TRACE_RING_SLOTS - 1)
+
+// Bit n of the result is set when byte n differs.
+static uint16_t changed_registers(const uint8_t *before, const uint8_t *after)
+{
+    uint64_t a[2], b[2];
+    memcpy(a, before, 16);
+    memcpy(b, after, 16);
+    if (a[0] == b[0] && a[1] == b[1]) {
+        return 0;
+    }
+    uint16_t mask = 0;
+    for (int i = 0; i < 16; i++) {
+        if (before[i] != after[i]) mask |= 1 << i;
+    }
+    return mask;
+}
+
+// Encodes the instruction the flush thread's machine has just been brought
+// past as a record against the decoder's state, and brings that up to date.
+// Returns the length.
+static size_t encode_record(Tracer *tracer, uint16_t pc, uint16_t opcode, bool gap, uint8_t *record)
+{
+    const CHIP8 *machine = &tracer->machine;
+    uint8_t *out = record + 1;
+    uint8_t flags = gap ? TRACE_GAP : 0;
+    if (pc != tracer->next_pc || gap) {
+        flags |= TRACE_PC;
+        *out++ = pc & 0xFF;
+        *out++ = pc >> 8;
+    }
+    *out++ = opcode >> 8;
+    *out++ = opcode & 0xFF;
+
+    // the decoder's state is stale after a gap, so send everything
+    uint16_t changed = gap ? 0xFFFF : changed_registers(tracer->registers, machine->registers);
+    if (changed) {
+        memcpy(tracer->registers, machine->registers, 16);
+        flags |= TRACE_REGS;
+        *out++ = changed & 0xFF;
+        *out++ = changed >> 8;
+        for (unsigned bits = changed; bits; bits &= bits - 1) {
+            *out++ = tracer->registers[__builtin_ctz(bits)];
+        }
+    }
+    if (machine->index != tracer->index || gap) {
+        flags |= TRACE_INDEX;
+        *out++ = machine->index & 0xFF;
+        *out++ = machine->index >> 8;
+        tracer->index = machine->index;
+    }
+    record[0] = flags;
+    tracer->next_pc = pc + 2;
+    return out - record;
+}
+
+static void *flush_thread(void *data)
+{
+    Tracer *tracer = data;
+    CHIP8 *machine = &tracer->machine;
+    uint8_t buffer[FLUSH_BUFFER];
+    size_t used = 0;
+    bool gap = false;
+    for (;;) {
+        bool running = atomic_load_explicit(&tracer->running, memory_order_acquire);
+        size_t head = atomic_load_explicit(&tracer->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&tracer->tail, memory_order_relaxed);
+        size_t value = atomic_load_explicit(&tracer->value_tail, memory_order_relaxed);
+        if (head == tail) {
+            fwrite(buffer, 1, used, tracer->file);
+            used = 0;
+            if (!running) {
+                break;
+            }
+            nanosleep(&(struct timespec) { .tv_nsec = 5000000 }, NULL);
+            continue;
+        }
+        while (tail != head) {
+            uint32_t step = tracer->steps[tail++ & RING_MASK];
+            if (STEP_FLAGS(step) & STEP_SYNC) {
+                memcpy(machine->registers, &tracer->values[value & RING_MASK], 8);
+                memcpy(machine->registers + 8, &tracer->values[(value + 1) & RING_MASK], 8);
+                machine->index = tracer->values[(value + 2) & RING_MASK];
+                value += SYNC_VALUES;
+                gap |= STEP_FLAGS(step) & STEP_GAP;
+                continue;
+            }
+            Instruction instruction = { .raw = step >> 12 };
+            uint8_t writes = Opcodes[DecodeOpcode(instruction.raw)].writes;
+            if (writes & WR_V0_VX) {
+                memcpy(machine->registers, &tracer->values[value & RING_MASK], 8);
+                memcpy(machine->registers + 8, &tracer->values[(value + 1) & RING_MASK], 8);
+                value += 2;
+            } else if (writes & WR_INPUT) {
+                machine->registers[writes & WR_VF ? 0xF : instruction.nibbles.x] = tracer->values[value++ & RING_MASK];
+            } else if (writes) {
+                ExecuteInstruction(machine, instruction);
+            }
+            used += encode_record(tracer, step & 0xFFF, instruction.raw, gap, buffer + used);
+            gap = false;
+            if (used > sizeof(buffer) - TRACE_MAX_RECORD) {
+                atomic_store_explicit(&tracer->value_tail, value, memory_order_release);
+                atomic_store_explicit(&tracer->tail, tail, memory_order_release);
+                fwrite(buffer, 1, used, tracer->file);
+                used = 0;
+            }
+        }
+        atomic_store_explicit(&tracer->value_tail, value, memory_order_release);
+        atomic_store_explicit(&tracer->tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+bool TracerOpen(Tracer *tracer, CHIP8 *chip8, const char *path)
+{
+    memset(tracer, 0, sizeof(*tracer));
+    tracer->file = fopen(path, "wb");
+    if (!tracer->file) {
+        perror("Failed to open trace file");
+        return false;
+    }
+    tracer->steps = malloc((TRACE_RING_SLOTS + STEP_SLACK) * sizeof(uint32_t));
+    tracer->values = malloc(TRACE_RING_SLOTS * sizeof(uint64_t));
+    if (!tracer->steps || !tracer->values) {
+        perror("Failed to allocate trace buffer");
+        free(tracer->steps);
+        free(tracer->values);
+        fclose(tracer->file);
+        return false;
+    }
+
+    uint8_t header[TRACE_HEADER_SIZE];
+    memcpy(header, TRACE_MAGIC, 4);
+    header[4] = TRACE_VERSION;
+    memcpy(header + 5, chip8->registers, 16);
+    header[21] = chip8->index & 0xFF;
+    header[22] = chip8->index >> 8;
+    fwrite(header, 1, sizeof(header), tracer->file);
+
+    memcpy(tracer->registers, chip8->registers, 16);
+    tracer->index = chip8->index;
+    tracer->next_pc = 0xFFFF; // force an explicit pc on the first record
+    atomic_store(&tracer->running, true);
+    if (pthread_create(&tracer->thread, NULL, flush_thread, tracer) != 0) {
+        perror("Failed to start trace thread");
+        free(tracer->steps);
+        free(tracer->values);
+        fclose(tracer->file);
+        return false;
+    }
+    chip8->tracer = tracer;
+    return true;
+}
+
+void TracerClose(Tracer *tracer, CHIP8 *chip8)
+{
+    if (!tracer->file) {
+        return;
+    }
+    chip8->tracer = NULL;
+    atomic_store_explicit(&tracer->running, false, memory_order_release);
+    pthread_join(tracer->thread, NULL);
+    fclose(tracer->file);
+    free(tracer->steps);
+    free(tracer->values);
+    tracer->file = NULL;
+    tracer->steps = NULL;
+    tracer->values = NULL;
+    if (tracer->dropped) {
+        fprintf(stderr, "trace: %llu records written, %llu dropped\n",
+            (unsigned long long)tracer->records, (unsigned long long)tracer->dropped);
+    }
+}
+
+// Records up to `cycles` instructions; the caller has made room for all of
+// them. With a debugger armed, stops where DebuggerRunCycles would: before
+// an instruction at a breakpoint, or after one that hit a watchpoint or was
+// single-stepped. Returns the instructions run.
+static int trace_batch(Tracer *tracer, CHIP8 *chip8, int cycles)
+{
+    size_t head = atomic_load_explicit(&tracer->head, memory_order_relaxed);
+    uint32_t *start = tracer->steps + (head & RING_MASK), *out = start;
+    TracerCaptureRegisters(tracer, chip8->registers);
+    TracerCapture(tracer, chip8->index);
+    *out++ = (uint32_t)(STEP_SYNC | (tracer->gap ? STEP_GAP : 0)) << 28;
+    tracer->gap = false;
+
+    // the step goes in before the instruction runs, so any values it
+    // captures follow it
+    int i;
+    Debugger *debugger = chip8->debugger;
+    if (!debugger) {
+        RecordCycles(chip8, out, cycles);
+        out += cycles;
+        i = cycles;
+    } else {
+        for (i = 0; i < cycles; i++) {
+            uint32_t pc = chip8->program_counter;
+            Instruction instruction = FetchInstruction(chip8);
+            if (chip8->debug_break) {
+                break;
+            }
+            *out++ = pc | (uint32_t)instruction.raw << 12;
+            ExecuteInstruction(chip8, instruction);
+            if (DebuggerExecuted(debugger)) {
+                i++;
+                break;
+            }
+        }
+    }
+    uint32_t *end = tracer->steps + TRACE_RING_SLOTS;
+    if (out > end) {
+        memcpy(tracer->steps, end, (out - end) * sizeof(uint32_t));
+    }
+    atomic_store_explicit(&tracer->head, head + (out - start), memory_order_release);
+    tracer->records += i;
+    return i;
+}
+
+// Room is checked once per batch rather than per instruction. The flush
+// thread's tails are only read when the cached copies say the batch won't
+// fit.
+int TracerRunCycles(Tracer *tracer, CHIP8 *chip8, int cycles)
+{
+    for (int done = 0; done < cycles; ) {
+        int batch = cycles - done < TRACE_BATCH ? cycles - done : TRACE_BATCH;
+        size_t steps = atomic_load_explicit(&tracer->head, memory_order_relaxed) + 1 + batch;
+        size_t values = tracer->value_head + SYNC_VALUES + (size_t)batch * CAPTURE_VALUES;
+        if (steps - tracer->cached_tail > TRACE_RING_SLOTS || values - tracer->cached_value_tail > TRACE_RING_SLOTS) {
+            tracer->cached_tail = atomic_load_explicit(&tracer->tail, memory_order_acquire);
+            tracer->cached_value_tail = atomic_load_explicit(&tracer->value_tail, memory_order_acquire);
+        }
+        int ran;
+        if (steps - tracer->cached_tail <= TRACE_RING_SLOTS && values - tracer->cached_value_tail <= TRACE_RING_SLOTS) {
+            ran = trace_batch(tracer, chip8, batch);
+        } else {
+            // the flush thread fell behind; the next batch resynchronizes.
+            // Detached meanwhile, so ExecuteInstruction captures nothing.
+            chip8->tracer = NULL;
+            ran = RunCycles(chip8, batch);
+            chip8->tracer = tracer;
+            tracer->dropped += ran;
+            tracer->gap = true;
+        }
+        done += ran;
+        if (ran < batch) {
+            return done; // stopped by the debugger
+        }
+    }
+    return cycles;
+}
@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "CHIP8.h"
+#include "trace_format.h"
+
+#define TRACE_RING_SLOTS (1 << 17) // steps and values each, must be a power of two
+
+// Two single-producer/single-consumer rings. For every instruction the
+// emulation thread stores a 4-byte step, just pc and opcode, and nothing
+// else: the flush thread runs the instruction again on its own copy of the
+// registers to learn what it changed. Only results that copy can't
+// reproduce (WR_INPUT in the opcode table: RND, the delay timer, the
+// keypad, DRW's collision flag and loads from RAM) are captured by
+// ExecuteInstruction into the value ring, along with the registers and I at
+// the start of every batch, which picks up changes made between batches. The
+// flush thread then delta-encodes records and writes them out. The two
+// sides' fields sit on separate cache lines, so draining the rings doesn't
+// steal the line the emulator writes every instruction.
+typedef struct Tracer {
+    // emulation thread
+    uint32_t *steps;
+    uint64_t *values;
+    atomic_size_t head; // in steps; the values they refer to are written first
+    size_t value_head;
+    size_t cached_tail, cached_value_tail; // reloaded only when a ring looks full
+    uint64_t records;
+    uint64_t dropped;
+    bool gap;
+
+    // flush thread
+    _Alignas(64) atomic_size_t tail;
+    atomic_size_t value_tail;
+    atomic_bool running;
+    CHIP8 machine;       // registers and I as the traced instructions leave them
+    Registers registers; // machine state as the decoder will have rebuilt it
+    uint16_t index;
+    uint16_t next_pc;    // pc the decoder will assume for the next record
+    FILE *file;
+    pthread_t thread;
+} Tracer;
+
+bool TracerOpen(Tracer *tracer, CHIP8 *chip8, const char *path);
+// Flushes the remaining records, detaches from the core and closes the file.
+void TracerClose(Tracer *tracer, CHIP8 *chip8);
+int TracerRunCycles(Tracer *tracer, CHIP8 *chip8, int cycles);
+
+// Called by ExecuteInstruction with what a WR_INPUT instruction wrote: the
+// one register its writes column names, or all sixteen for LD Vx, [I].
+static inline void TracerCapture(Tracer *tracer, uint64_t value)
+{
+    tracer->values[tracer->value_head++ & (TRACE_RING_SLOTS - 1)] = value;
+}
+
+static inline void TracerCaptureRegisters(Tracer *tracer, const uint8_t *registers)
+{
+    uint64_t words[2];
+    memcpy(words, registers, sizeof(words));
+    TracerCapture(tracer, words[0]);
+    TracerCapture(tracer, words[1]);
+}
+
+#endif
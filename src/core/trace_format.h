@@ -0,0 +1,33 @@
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+#include <stdint.h>
+
+// Binary execution trace, shared by the tracer and ch8trace.
+//
+// File header (little endian):
+//   char     magic[4]    "CH8T"
+//   uint8_t  version
+//   uint8_t  registers[16]   state before the first record
+//   uint16_t index
+//
+// Records are delta encoded against the reconstructed machine state:
+//   uint8_t  flags
+//   uint16_t pc              if TRACE_PC (omitted when pc == previous pc + 2)
+//   uint16_t opcode          always, big endian as in RAM
+//   uint16_t changed         if TRACE_REGS, bit n set when Vn changed
+//   uint8_t  values[]        one per set bit, in register order
+//   uint16_t index           if TRACE_INDEX
+#define TRACE_MAGIC "CH8T"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE (4 + 1 + 16 + 2)
+#define TRACE_MAX_RECORD (1 + 2 + 2 + 2 + 16 + 2)
+
+enum {
+    TRACE_PC = 1 << 0,
+    TRACE_REGS = 1 << 1,
+    TRACE_INDEX = 1 << 2,
+    TRACE_GAP = 1 << 3, // records were dropped before this one
+};
+
+#endif
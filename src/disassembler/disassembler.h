@@ -4,35 +4,9 @@
 #include <stdint.h>
 #include <stddef.h>
 
-#define MAX_OPCODE_LEN 64
-
-typedef union {
-    uint16_t raw;
-
-    struct {
-        uint16_t n : 4;
-        uint16_t y : 4;
-        uint16_t x : 4;
-        uint16_t : 4;
-    } nibbles;
-
-    struct {
-        uint16_t nn : 8;
-        uint16_t x : 4;
-        uint16_t : 4;
-    } type6;
+#include "opcodes.h"
 
-    struct {
-        uint16_t nnn : 12;
-        uint16_t : 4;
-    } addr;
-
-    struct {
-        uint16_t : 12;
-        uint16_t opcode : 4;
-    };
-
-} Instruction;
+#define MAX_OPCODE_LEN 64
 
 typedef enum {
     SUCCESS = 0,
@@ -0,0 +1,413 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, nanosleep
+#include "CHIP8.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CPU_FREQ 500
+#define FRAME_RATE 60
+#define MAP_SIZE 65536
+#define MAX_THREADS 64
+#define MAX_RUN_EDGES 65536
+#define RECENT_ENTRIES 64
+#define MAX_CALLS 16         // levels of Stack
+
+// A machine state worth exploring from, plus the input that reached it.
+typedef struct {
+    CHIP8 state;
+    uint16_t *inputs;        // keypad masks from the parent entry to this one
+    int input_count;
+    long depth;              // frames since boot
+    int calls;               // return addresses on the stack, 0 to 16
+} CorpusEntry;
+
+typedef enum {
+    FAULT_INVALID,           // word with no opcode, silently skipped by the core
+    FAULT_STACK_OVERFLOW,    // 17th nested CALL, overwrites the oldest return address
+    FAULT_STACK_UNDERFLOW,   // RET with no CALL to return from
+    FAULT_KINDS,
+} FaultKind;
+
+static const char *fault_names[FAULT_KINDS] = { "invalid opcode", "stack overflow", "stack underflow" };
+
+typedef struct {
+    atomic_ullong hits;
+    atomic_ushort opcode;    // first word seen at this address
+    atomic_long depth;       // frames from boot to the first hit
+    atomic_long found_at;    // milliseconds into the session
+} FaultSite;
+
+typedef struct {
+    int threads;
+    int frames_per_run;
+    long seconds;
+    uint64_t max_execs;
+    bool quiet;
+} Options;
+
+typedef struct {
+    uint64_t rng;
+    CHIP8 chip8;
+    int calls;               // nesting depth of chip8; stack_pointer alone wraps at 16
+    CHIP8 best;              // last state of this run that found new coverage
+    int best_calls;
+    uint16_t inputs[4096];
+    uint8_t counts[MAP_SIZE];
+    uint16_t touched[MAX_RUN_EDGES];
+    int touched_count;
+    uint64_t instructions;   // since the last flush into the global counter
+} Worker;
+
+static Options options = { .frames_per_run = 60, .seconds = 60 };
+
+// Global coverage: for every edge, the hit-count buckets any run has reached.
+static atomic_uchar coverage[MAP_SIZE];
+static atomic_uint edges;
+
+static pthread_mutex_t corpus_lock = PTHREAD_MUTEX_INITIALIZER;
+static CorpusEntry **corpus;
+static int corpus_count, corpus_capacity;
+
+static FaultSite faults[FAULT_KINDS][CHIP8_RAM_SIZE];
+static atomic_uint fault_sites[FAULT_KINDS];
+
+static atomic_ullong execs, frames, instructions;
+static atomic_bool stop;
+static struct timespec started;
+
+static long elapsed_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - started.tv_sec) * 1000 + (now.tv_nsec - started.tv_nsec) / 1000000;
+}
+
+static uint64_t next_random(Worker *worker)
+{
+    // xorshift64*
+    worker->rng ^= worker->rng >> 12;
+    worker->rng ^= worker->rng << 25;
+    worker->rng ^= worker->rng >> 27;
+    return worker->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static int random_below(Worker *worker, int n)
+{
+    return (int)((next_random(worker) >> 32) % n);
+}
+
+// AFL-style hit-count classes, so a loop running more often counts as new.
+static uint8_t bucket(uint8_t count)
+{
+    if (count <= 3) return count == 3 ? 4 : count;
+    if (count <= 7) return 8;
+    if (count <= 15) return 16;
+    if (count <= 31) return 32;
+    if (count <= 127) return 64;
+    return 128;
+}
+
+static uint16_t edge_index(uint16_t from, uint16_t to, uint16_t opcode)
+{
+    uint32_t key = (uint32_t)from << 12 | to;
+    return (uint16_t)((key * 0x9E3779B1u) >> 16) ^ opcode;
+}
+
+static void add_entry(CorpusEntry *entry)
+{
+    pthread_mutex_lock(&corpus_lock);
+    if (corpus_count == corpus_capacity) {
+        corpus_capacity = corpus_capacity ? corpus_capacity * 2 : 256;
+        corpus = realloc(corpus, corpus_capacity * sizeof(*corpus));
+    }
+    corpus[corpus_count++] = entry;
+    pthread_mutex_unlock(&corpus_lock);
+}
+
+// Half the time one of the newest entries, since that is where the frontier is.
+static CorpusEntry *pick_entry(Worker *worker)
+{
+    pthread_mutex_lock(&corpus_lock);
+    int count = corpus_count;
+    int choice = random_below(worker, count);
+    if (count > RECENT_ENTRIES && random_below(worker, 2)) {
+        choice = count - 1 - random_below(worker, RECENT_ENTRIES);
+    }
+    CorpusEntry *entry = corpus[choice];
+    pthread_mutex_unlock(&corpus_lock);
+    return entry;
+}
+
+static void record_fault(FaultKind kind, uint16_t pc, uint16_t opcode, long depth)
+{
+    FaultSite *site = &faults[kind][pc & (CHIP8_RAM_SIZE - 1)];
+    if (atomic_fetch_add(&site->hits, 1) == 0) {
+        atomic_store(&site->opcode, opcode);
+        atomic_store(&site->depth, depth);
+        atomic_store(&site->found_at, elapsed_ms());
+        atomic_fetch_add(&fault_sites[kind], 1);
+    }
+}
+
+// Held keys change every few frames: nothing, one key, or a chord of two.
+static void mutate_inputs(Worker *worker, const CorpusEntry *parent, int count)
+{
+    int i = 0;
+    if (parent->input_count && random_below(worker, 4) == 0) {
+        // repeat the input that reached the parent, with a few bits flipped
+        for (; i < count && i < parent->input_count; i++) {
+            worker->inputs[i] = parent->inputs[i];
+            if (random_below(worker, 8) == 0) {
+                worker->inputs[i] ^= 1 << random_below(worker, 16);
+            }
+        }
+    }
+    while (i < count) {
+        uint16_t keys = 0;
+        switch (random_below(worker, 4)) {
+            case 0: break;
+            case 3: keys |= 1 << random_below(worker, 16); // fallthrough
+            default: keys |= 1 << random_below(worker, 16); break;
+        }
+        int hold = 1 + random_below(worker, 20);
+        for (; hold > 0 && i < count; hold--) {
+            worker->inputs[i++] = keys;
+        }
+    }
+}
+
+// Runs one frame, counting edges into the worker's map. Returns false when
+// the run hit a fault and should not continue.
+static bool run_frame(Worker *worker, int cycles, long depth)
+{
+    CHIP8 *chip8 = &worker->chip8;
+    for (int i = 0; i < cycles; i++) {
+        uint16_t pc = chip8->program_counter;
+        Instruction instruction = FetchInstruction(chip8);
+        Opcode op = DecodeOpcode(instruction.raw);
+        if (op == OP_INVALID) {
+            record_fault(FAULT_INVALID, pc, instruction.raw, depth);
+            return false;
+        }
+        if (op == OP_CALL && ++worker->calls > MAX_CALLS) {
+            record_fault(FAULT_STACK_OVERFLOW, pc, instruction.raw, depth);
+            return false;
+        }
+        if (op == OP_RET && --worker->calls < 0) {
+            record_fault(FAULT_STACK_UNDERFLOW, pc, instruction.raw, depth);
+            return false;
+        }
+        ExecuteInstruction(chip8, instruction);
+
+        uint16_t edge = edge_index(pc, chip8->program_counter, instruction.raw);
+        if (worker->counts[edge] == 0 && worker->touched_count < MAX_RUN_EDGES) {
+            worker->touched[worker->touched_count++] = edge;
+        }
+        if (worker->counts[edge] < 255) {
+            worker->counts[edge]++;
+        }
+    }
+    worker->instructions += cycles;
+    return true;
+}
+
+static void discard_coverage(Worker *worker)
+{
+    for (int i = 0; i < worker->touched_count; i++) {
+        worker->counts[worker->touched[i]] = 0;
+    }
+    worker->touched_count = 0;
+}
+
+// Folds the frame's edges into the global map and clears the local one.
+// Returns true when any edge reached a bucket no run had reached before.
+static bool merge_coverage(Worker *worker)
+{
+    bool interesting = false;
+    for (int i = 0; i < worker->touched_count; i++) {
+        uint16_t edge = worker->touched[i];
+        uint8_t bits = bucket(worker->counts[edge]);
+        worker->counts[edge] = 0;
+        if (atomic_load_explicit(&coverage[edge], memory_order_relaxed) & bits) {
+            continue;
+        }
+        uint8_t old = atomic_fetch_or(&coverage[edge], bits);
+        if (!(old & bits)) {
+            interesting = true;
+            if (old == 0) {
+                atomic_fetch_add(&edges, 1);
+            }
+        }
+    }
+    worker->touched_count = 0;
+    return interesting;
+}
+
+// Forks one run from a corpus entry. Forking is a struct copy; the corpus
+// never has subsystems attached, so there are no pointers to fix up.
+static void explore_once(Worker *worker)
+{
+    CorpusEntry *parent = pick_entry(worker);
+    int count = options.frames_per_run;
+    mutate_inputs(worker, parent, count);
+    worker->chip8 = parent->state;
+    worker->calls = parent->calls;
+
+    int best_frames = 0, i;
+    long frame = parent->depth;
+    for (i = 0; i < count; i++, frame++) {
+        int cycles = (frame % FRAME_RATE + 1) * CPU_FREQ / FRAME_RATE - (frame % FRAME_RATE) * CPU_FREQ / FRAME_RATE;
+        UpdateKeypad(&worker->chip8, worker->inputs[i]);
+        bool alive = run_frame(worker, cycles, frame + 1);
+        UpdateTimers(&worker->chip8);
+        if (!alive) {
+            discard_coverage(worker); // a faulting run is reported, not explored further
+            break;
+        }
+        if (merge_coverage(worker)) {
+            worker->best = worker->chip8;
+            worker->best_calls = worker->calls;
+            best_frames = i + 1;
+        }
+    }
+    atomic_fetch_add_explicit(&frames, i, memory_order_relaxed);
+    atomic_fetch_add_explicit(&instructions, worker->instructions, memory_order_relaxed);
+    atomic_fetch_add_explicit(&execs, 1, memory_order_relaxed);
+    worker->instructions = 0;
+
+    if (best_frames) {
+        CorpusEntry *entry = malloc(sizeof(*entry));
+        entry->state = worker->best;
+        entry->input_count = best_frames;
+        entry->inputs = malloc(best_frames * sizeof(uint16_t));
+        memcpy(entry->inputs, worker->inputs, best_frames * sizeof(uint16_t));
+        entry->depth = parent->depth + best_frames;
+        entry->calls = worker->best_calls;
+        add_entry(entry);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    Worker *worker = arg;
+    while (!atomic_load(&stop)) {
+        explore_once(worker);
+        if (options.max_execs && atomic_load(&execs) >= options.max_execs) {
+            atomic_store(&stop, true);
+        }
+    }
+    return NULL;
+}
+
+static void print_status(uint64_t last_execs, unsigned last_edges, double interval)
+{
+    pthread_mutex_lock(&corpus_lock);
+    int entries = corpus_count;
+    pthread_mutex_unlock(&corpus_lock);
+    uint64_t now_execs = atomic_load(&execs);
+    unsigned now_edges = atomic_load(&edges);
+    fprintf(stderr, "[%5.1fs] execs %llu (%.0f/s)  corpus %d  edges %u (%+.1f/s)  invalid %u  overflow %u  underflow %u\n",
+        elapsed_ms() / 1000.0, (unsigned long long)now_execs, (now_execs - last_execs) / interval,
+        entries, now_edges, (now_edges - last_edges) / interval,
+        atomic_load(&fault_sites[FAULT_INVALID]), atomic_load(&fault_sites[FAULT_STACK_OVERFLOW]),
+        atomic_load(&fault_sites[FAULT_STACK_UNDERFLOW]));
+}
+
+static void print_report(void)
+{
+    double seconds = elapsed_ms() / 1000.0;
+    uint64_t total_execs = atomic_load(&execs);
+    printf("%.1f s, %d threads: %llu runs, %llu frames, %.1f M instructions/s\n",
+        seconds, options.threads, (unsigned long long)total_execs, (unsigned long long)atomic_load(&frames),
+        atomic_load(&instructions) / seconds / 1e6);
+    printf("coverage: %u edges, corpus %d snapshots (%.1f MB)\n",
+        atomic_load(&edges), corpus_count, corpus_count * sizeof(CorpusEntry) / 1e6);
+
+    for (int kind = 0; kind < FAULT_KINDS; kind++) {
+        printf("%s: %u sites\n", fault_names[kind], atomic_load(&fault_sites[kind]));
+        for (int pc = 0; pc < CHIP8_RAM_SIZE; pc++) {
+            FaultSite *site = &faults[kind][pc];
+            uint64_t hits = atomic_load(&site->hits);
+            if (!hits) {
+                continue;
+            }
+            printf("  %03X  %04X  %8llu hits, first after %ld frames of input, %.1f s in\n",
+                pc, atomic_load(&site->opcode), (unsigned long long)hits,
+                atomic_load(&site->depth), atomic_load(&site->found_at) / 1000.0);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *rom = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            options.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            options.seconds = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            options.max_execs = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            options.frames_per_run = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-q") == 0) {
+            options.quiet = true;
+        } else if (!rom && argv[i][0] != '-') {
+            rom = argv[i];
+        } else {
+            rom = NULL;
+            break;
+        }
+    }
+    if (!rom || options.frames_per_run < 1 || options.frames_per_run > 4096) {
+        fprintf(stderr, "Usage: %s [-j threads] [-t seconds] [-n runs] [-f frames per run] [-q] <ROM file>\n", argv[0]);
+        return 1;
+    }
+    if (options.threads <= 0) {
+        options.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (options.threads > MAX_THREADS) options.threads = MAX_THREADS;
+    if (options.threads < 1) options.threads = 1;
+
+    CorpusEntry *root = calloc(1, sizeof(*root));
+    InitializeCHIP8(&root->state);
+    if (LoadROM(&root->state, rom) < 0) {
+        return 1;
+    }
+    add_entry(root);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    static Worker workers[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    for (int i = 0; i < options.threads; i++) {
+        workers[i].rng = ((uint64_t)started.tv_nsec << 20 ^ (uint64_t)started.tv_sec) + 0x9E3779B97F4A7C15ULL * (i + 1);
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+
+    uint64_t last_execs = 0;
+    unsigned last_edges = 0;
+    long last_ms = 0;
+    while (!atomic_load(&stop)) {
+        nanosleep(&(struct timespec) { .tv_nsec = 100000000 }, NULL);
+        long now = elapsed_ms();
+        if (options.seconds && now >= options.seconds * 1000) {
+            atomic_store(&stop, true);
+        }
+        if (!options.quiet && now - last_ms >= 1000) {
+            print_status(last_execs, last_edges, (now - last_ms) / 1000.0);
+            last_execs = atomic_load(&execs);
+            last_edges = atomic_load(&edges);
+            last_ms = now;
+        }
+    }
+    for (int i = 0; i < options.threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    print_report();
+    return 0;
+}
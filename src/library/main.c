@@ -0,0 +1,496 @@
+#define _XOPEN_SOURCE 700 // nftw
+#include "CHIP8.h"
+#include "library.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CPU_FREQ 500
+#define FRAME_RATE 60
+#define PROBE_FRAMES 60    // frames run headless to observe code, data and the first screen
+
+typedef struct {
+    LibraryEntry *entries;
+    int count, capacity;
+    char *paths;
+    size_t paths_size, paths_capacity;
+    uint32_t *by_hash;     // open-addressed entry index + 1, rebuilt as entries are added
+    uint32_t hash_slots;
+} Builder;
+
+typedef struct {
+    long reused, hashed, analyzed, skipped;
+} IndexStats;
+
+// State for the nftw callback, which takes no user pointer.
+static Builder builder;
+static Library previous;
+static bool have_previous;
+static uint32_t *previous_by_path; // previous entry index + 1, keyed by path hash
+static uint32_t previous_path_slots;
+static IndexStats index_stats;
+
+static double now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static uint64_t hash_path(const char *path)
+{
+    return LibraryHash((const uint8_t *)path, strlen(path));
+}
+
+static void set_use(LibraryEntry *entry, int offset, ByteUse use)
+{
+    if (offset < 0 || offset >= entry->size || LibraryByteUse(entry, offset) != BYTE_UNKNOWN) {
+        return;
+    }
+    entry->map[offset / 4] |= use << (offset % 4 * 2);
+}
+
+static void mark_range(LibraryEntry *entry, uint16_t addr, int length, ByteUse use)
+{
+    for (int i = 0; i < length; i++) {
+        set_use(entry, addr + i - CHIP8_ROM_ADDR, use);
+    }
+}
+
+static uint16_t quirks_of(Opcode op)
+{
+    switch (op) {
+        case OP_SHR: case OP_SHL: return LIBRARY_QUIRK_SHIFT;
+        case OP_LD_MEM_VX: case OP_LD_VX_MEM: return LIBRARY_QUIRK_LOAD_STORE;
+        case OP_JP_VX: return LIBRARY_QUIRK_JUMP;
+        case OP_OR: case OP_AND: case OP_XOR: return LIBRARY_QUIRK_LOGIC_VF;
+        default: return 0;
+    }
+}
+
+// Marks every instruction statically reachable from the entry point.
+static void walk_code(const uint8_t *rom, LibraryEntry *entry)
+{
+    static uint16_t worklist[LIBRARY_ROM_MAX * 2];
+    static bool queued[CHIP8_RAM_SIZE];
+    int pending = 0;
+    memset(queued, 0, sizeof(queued));
+    worklist[pending++] = CHIP8_ROM_ADDR;
+    queued[CHIP8_ROM_ADDR] = true;
+    while (pending > 0) {
+        uint16_t addr = worklist[--pending];
+        int offset = addr - CHIP8_ROM_ADDR;
+        if (offset < 0 || offset + 1 >= entry->size) {
+            continue;
+        }
+        Instruction in = { .raw = rom[offset] << 8 | rom[offset + 1] };
+        Opcode op = DecodeOpcode(in.raw);
+        if (op == OP_INVALID) {
+            continue;
+        }
+        mark_range(entry, addr, 2, BYTE_CODE);
+        entry->quirks |= quirks_of(op);
+
+        uint16_t next[2];
+        int count = 0;
+        switch (op) {
+            case OP_RET: case OP_JP_VX: break;
+            case OP_JP: next[count++] = in.addr.nnn; break;
+            case OP_CALL: next[count++] = in.addr.nnn; next[count++] = addr + 2; break;
+            case OP_SE_BYTE: case OP_SNE_BYTE: case OP_SE_REG: case OP_SNE_REG: case OP_SKP: case OP_SKNP:
+                next[count++] = addr + 2;
+                next[count++] = addr + 4;
+                break;
+            default: next[count++] = addr + 2; break;
+        }
+        for (int i = 0; i < count; i++) {
+            uint16_t target = next[i] & 0xFFF;
+            if (!queued[target]) {
+                queued[target] = true;
+                worklist[pending++] = target;
+            }
+        }
+    }
+}
+
+// Runs the first PROBE_FRAMES frames with no keys held, recording what each
+// byte is used as and the first screen that has something on it.
+static void probe(const uint8_t *rom, LibraryEntry *entry)
+{
+    static CHIP8 chip8;
+    InitializeCHIP8(&chip8);
+    LoadROMImage(&chip8, rom, entry->size);
+    for (int frame = 0; frame < PROBE_FRAMES; frame++) {
+        SeedRandom(&chip8, frame + 1); // RND-driven title screens come out the same every time
+        UpdateKeypad(&chip8, 0);
+        int cycles = (frame % FRAME_RATE + 1) * CPU_FREQ / FRAME_RATE - (frame % FRAME_RATE) * CPU_FREQ / FRAME_RATE;
+        for (int i = 0; i < cycles; i++) {
+            uint16_t pc = chip8.program_counter;
+            Instruction in = FetchInstruction(&chip8);
+            Opcode op = DecodeOpcode(in.raw);
+            mark_range(entry, pc, 2, BYTE_CODE);
+            entry->quirks |= quirks_of(op);
+            switch (op) {
+                case OP_DRW: {
+                    int x = chip8.registers[in.nibbles.x] % 64, y = chip8.registers[in.nibbles.y] % 32;
+                    if (x + 8 > 64 || y + in.nibbles.n > 32) {
+                        entry->quirks |= LIBRARY_QUIRK_CLIP;
+                    }
+                    mark_range(entry, chip8.index, in.nibbles.n, BYTE_DATA);
+                    break;
+                }
+                case OP_LD_VX_MEM: mark_range(entry, chip8.index, in.nibbles.x + 1, BYTE_DATA); break;
+                case OP_LD_MEM_VX: mark_range(entry, chip8.index, in.nibbles.x + 1, BYTE_WRITTEN); break;
+                case OP_LD_B_VX: mark_range(entry, chip8.index, 3, BYTE_WRITTEN); break;
+                default: break;
+            }
+            ExecuteInstruction(&chip8, in);
+        }
+        UpdateTimers(&chip8);
+        if (!entry->snapshot_frame) {
+            for (int row = 0; row < 32; row++) {
+                if (chip8.screen[row]) {
+                    memcpy(entry->snapshot, chip8.screen, sizeof(Screen));
+                    entry->snapshot_frame = frame + 1;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void analyze(const uint8_t *rom, LibraryEntry *entry)
+{
+    walk_code(rom, entry);
+    probe(rom, entry);
+    for (int offset = 0; offset < entry->size; offset++) {
+        ByteUse use = LibraryByteUse(entry, offset);
+        entry->code_bytes += use == BYTE_CODE;
+        entry->data_bytes += use == BYTE_DATA;
+    }
+    entry->cycles_per_second = CPU_FREQ;
+}
+
+static uint32_t add_path(const char *path)
+{
+    size_t length = strlen(path) + 1;
+    if (builder.paths_size + length > builder.paths_capacity) {
+        builder.paths_capacity = (builder.paths_capacity + length) * 2;
+        builder.paths = realloc(builder.paths, builder.paths_capacity);
+    }
+    memcpy(builder.paths + builder.paths_size, path, length);
+    builder.paths_size += length;
+    return (uint32_t)(builder.paths_size - length);
+}
+
+// Open-addressed table from content hash to entry; first entry wins.
+static void rebuild_hash_table(uint32_t **slots, uint32_t *slot_count, const LibraryEntry *entries, int count)
+{
+    uint32_t size = 16;
+    while (size < (uint32_t)count * 2) size *= 2;
+    free(*slots);
+    *slots = calloc(size, sizeof(uint32_t));
+    *slot_count = size;
+    for (int i = 0; i < count; i++) {
+        uint32_t slot = (uint32_t)entries[i].hash & (size - 1);
+        bool duplicate = false;
+        for (; (*slots)[slot]; slot = (slot + 1) & (size - 1)) {
+            if (entries[(*slots)[slot] - 1].hash == entries[i].hash) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (!duplicate) {
+            (*slots)[slot] = i + 1;
+        }
+    }
+}
+
+static const LibraryEntry *find_built(uint64_t hash)
+{
+    if (!builder.by_hash) {
+        return NULL;
+    }
+    uint32_t mask = builder.hash_slots - 1;
+    for (uint32_t slot = (uint32_t)hash & mask; builder.by_hash[slot]; slot = (slot + 1) & mask) {
+        if (builder.entries[builder.by_hash[slot] - 1].hash == hash) {
+            return &builder.entries[builder.by_hash[slot] - 1];
+        }
+    }
+    return NULL;
+}
+
+static void insert_built(int index)
+{
+    if ((uint32_t)builder.count * 2 > builder.hash_slots) {
+        rebuild_hash_table(&builder.by_hash, &builder.hash_slots, builder.entries, builder.count);
+        return;
+    }
+    uint32_t mask = builder.hash_slots - 1;
+    uint32_t slot = (uint32_t)builder.entries[index].hash & mask;
+    for (; builder.by_hash[slot]; slot = (slot + 1) & mask) {
+        if (builder.entries[builder.by_hash[slot] - 1].hash == builder.entries[index].hash) {
+            return;
+        }
+    }
+    builder.by_hash[slot] = index + 1;
+}
+
+static const LibraryEntry *find_previous_path(const char *path)
+{
+    if (!have_previous) {
+        return NULL;
+    }
+    uint32_t mask = previous_path_slots - 1;
+    for (uint32_t slot = (uint32_t)hash_path(path) & mask; previous_by_path[slot]; slot = (slot + 1) & mask) {
+        const LibraryEntry *entry = &previous.entries[previous_by_path[slot] - 1];
+        if (strcmp(LibraryPath(&previous, entry), path) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void index_previous_paths(void)
+{
+    uint32_t size = 16;
+    while (size < previous.header->entry_count * 2) size *= 2;
+    previous_by_path = calloc(size, sizeof(uint32_t));
+    previous_path_slots = size;
+    for (uint32_t i = 0; i < previous.header->entry_count; i++) {
+        uint32_t slot = (uint32_t)hash_path(LibraryPath(&previous, &previous.entries[i])) & (size - 1);
+        while (previous_by_path[slot]) slot = (slot + 1) & (size - 1);
+        previous_by_path[slot] = i + 1;
+    }
+}
+
+static int visit(const char *path, const struct stat *info, int type, struct FTW *ftw)
+{
+    if (type != FTW_F || !S_ISREG(info->st_mode)) {
+        return 0;
+    }
+    if (info->st_size == 0 || info->st_size > LIBRARY_ROM_MAX) {
+        index_stats.skipped++;
+        return 0;
+    }
+    if (builder.count == builder.capacity) {
+        builder.capacity = builder.capacity ? builder.capacity * 2 : 1024;
+        builder.entries = realloc(builder.entries, builder.capacity * sizeof(LibraryEntry));
+    }
+    LibraryEntry *entry = &builder.entries[builder.count];
+    int64_t mtime_ns = (int64_t)info->st_mtim.tv_sec * 1000000000 + info->st_mtim.tv_nsec;
+
+    const LibraryEntry *known = find_previous_path(path);
+    if (known && known->mtime_ns == mtime_ns && known->size == info->st_size) {
+        *entry = *known;
+        index_stats.reused++;
+    } else {
+        uint8_t rom[LIBRARY_ROM_MAX];
+        FILE *file = fopen(path, "rb");
+        size_t size = file ? fread(rom, 1, sizeof(rom), file) : 0;
+        if (file) fclose(file);
+        if (size == 0) {
+            index_stats.skipped++;
+            return 0;
+        }
+        uint64_t hash = LibraryHash(rom, size);
+        known = find_built(hash);
+        if (!known && have_previous) {
+            known = LibraryFind(&previous, hash);
+        }
+        if (known) {
+            *entry = *known; // same content under another name, or renamed
+            index_stats.hashed++;
+        } else {
+            memset(entry, 0, sizeof(*entry));
+            entry->hash = hash;
+            entry->size = (uint16_t)size;
+            analyze(rom, entry);
+            index_stats.analyzed++;
+        }
+    }
+    entry->mtime_ns = mtime_ns;
+    entry->path_offset = add_path(path);
+    insert_built(builder.count++);
+    return 0;
+}
+
+static bool write_index(const char *index_path)
+{
+    uint32_t *slots = NULL, slot_count = 0;
+    rebuild_hash_table(&slots, &slot_count, builder.entries, builder.count);
+
+    LibraryHeader header = {
+        .magic = LIBRARY_MAGIC,
+        .version = LIBRARY_VERSION,
+        .entry_count = builder.count,
+        .slot_count = slot_count,
+    };
+    header.entries_offset = (sizeof(header) + slot_count * sizeof(uint32_t) + 63) & ~(uint64_t)63;
+    header.paths_offset = header.entries_offset + (uint64_t)builder.count * sizeof(LibraryEntry);
+    header.paths_size = builder.paths_size;
+
+    // written next to the old index and renamed over it, so running
+    // emulators keep their mapping of the old one
+    char temp_path[4096];
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", index_path, (int)getpid());
+    FILE *out = fopen(temp_path, "wb");
+    if (!out) {
+        perror(temp_path);
+        free(slots);
+        return false;
+    }
+    static const uint8_t padding[64];
+    size_t pad = header.entries_offset - sizeof(header) - slot_count * sizeof(uint32_t);
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(slots, sizeof(uint32_t), slot_count, out) == slot_count &&
+              fwrite(padding, 1, pad, out) == pad &&
+              fwrite(builder.entries, sizeof(LibraryEntry), builder.count, out) == (size_t)builder.count &&
+              fwrite(builder.paths, 1, builder.paths_size, out) == builder.paths_size;
+    ok = fclose(out) == 0 && ok;
+    free(slots);
+    if (!ok || rename(temp_path, index_path) != 0) {
+        perror(index_path);
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
+
+static int build(const char *dir, const char *index_path)
+{
+    double start = now_us();
+    if (access(index_path, F_OK) == 0) {
+        have_previous = LibraryOpen(&previous, index_path, false);
+        if (have_previous) {
+            index_previous_paths();
+        }
+    }
+    if (nftw(dir, visit, 64, FTW_PHYS) != 0) {
+        perror(dir);
+        return 1;
+    }
+    if (!write_index(index_path)) {
+        return 1;
+    }
+    if (have_previous) {
+        LibraryClose(&previous);
+    }
+    printf("%d ROMs in %.1f ms: %ld unchanged, %ld known content, %ld analyzed, %ld skipped\n",
+        builder.count, (now_us() - start) / 1e3, index_stats.reused, index_stats.hashed,
+        index_stats.analyzed, index_stats.skipped);
+    return 0;
+}
+
+static void print_entry(const Library *library, const LibraryEntry *entry, bool full)
+{
+    char quirks[128];
+    LibraryQuirkNames(entry->quirks, quirks, sizeof(quirks));
+    printf("%016llx %5u bytes %5u Hz  quirks: %-28s %s\n",
+        (unsigned long long)entry->hash, entry->size, entry->cycles_per_second, quirks, LibraryPath(library, entry));
+    if (!full) {
+        return;
+    }
+    int written = 0, unknown = 0;
+    for (int offset = 0; offset < entry->size; offset++) {
+        written += LibraryByteUse(entry, offset) == BYTE_WRITTEN;
+        unknown += LibraryByteUse(entry, offset) == BYTE_UNKNOWN;
+    }
+    printf("code %u bytes, data %u bytes, written %d bytes, unknown %d bytes\n",
+        entry->code_bytes, entry->data_bytes, written, unknown);
+    if (!entry->snapshot_frame) {
+        printf("nothing drawn in the first %d frames\n", PROBE_FRAMES);
+        return;
+    }
+    printf("screen after frame %u:\n", entry->snapshot_frame);
+    for (int row = 0; row < 32; row++) {
+        char line[65];
+        for (int col = 0; col < 64; col++) {
+            line[col] = (entry->snapshot[row] >> (63 - col)) & 1 ? '#' : ' ';
+        }
+        line[64] = '\0';
+        printf("|%s|\n", line);
+    }
+}
+
+// Loads the ROM, hashes it and looks it up, the way a launch does.
+static LibraryEntry *lookup(const Library *library, const char *rom_path, double *load_us, double *find_us)
+{
+    double start = now_us();
+    static CHIP8 chip8;
+    long size = LoadROM(&chip8, rom_path);
+    if (size < 0) {
+        return NULL;
+    }
+    double loaded = now_us();
+    LibraryEntry *entry = LibraryFind(library, LibraryHash(chip8.ram + CHIP8_ROM_ADDR, size));
+    *load_us = loaded - start;
+    *find_us = now_us() - loaded;
+    if (!entry) {
+        fprintf(stderr, "%s is not in the library\n", rom_path);
+    }
+    return entry;
+}
+
+int main(int argc, char *argv[])
+{
+    InitializeOpcodes();
+    if (argc == 4 && strcmp(argv[1], "index") == 0) {
+        return build(argv[2], argv[3]);
+    }
+    if ((argc == 3 && strcmp(argv[1], "list") == 0) ||
+        (argc == 4 && strcmp(argv[1], "info") == 0) ||
+        (argc == 6 && strcmp(argv[1], "set") == 0 && strcmp(argv[4], "speed") == 0)) {
+        double start = now_us();
+        bool writable = argv[1][0] == 's';
+        Library library;
+        if (!LibraryOpen(&library, argv[2], writable)) {
+            return 1;
+        }
+        double open_us = now_us() - start;
+        if (argv[1][0] == 'l') {
+            for (uint32_t i = 0; i < library.header->entry_count; i++) {
+                print_entry(&library, &library.entries[i], false);
+            }
+            LibraryClose(&library);
+            return 0;
+        }
+        double load_us, find_us;
+        LibraryEntry *entry = lookup(&library, argv[3], &load_us, &find_us);
+        if (!entry) {
+            LibraryClose(&library);
+            return 1;
+        }
+        if (writable) {
+            int speed = atoi(argv[5]);
+            if (speed <= 0 || speed > UINT16_MAX) {
+                fprintf(stderr, "speed must be 1-%d instructions per second\n", UINT16_MAX);
+                LibraryClose(&library);
+                return 1;
+            }
+            // every copy of this content shares the recommendation
+            for (uint32_t i = 0; i < library.header->entry_count; i++) {
+                if (library.entries[i].hash == entry->hash) {
+                    library.entries[i].cycles_per_second = (uint16_t)speed;
+                }
+            }
+        }
+        print_entry(&library, entry, !writable);
+        if (!writable) {
+            printf("open index %.1f us, load ROM %.1f us, hash and look up %.1f us (%u entries)\n",
+                open_us, load_us, find_us, library.header->entry_count);
+        }
+        LibraryClose(&library);
+        return 0;
+    }
+    fprintf(stderr, "Usage: %s index <ROM directory> <index>\n", argv[0]);
+    fprintf(stderr, "       %s list <index>\n", argv[0]);
+    fprintf(stderr, "       %s info <index> <ROM file>\n", argv[0]);
+    fprintf(stderr, "       %s set <index> <ROM file> speed <instructions per second>\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,197 @@
+// ch8ld: links objects from `ch8asm -c` into a ROM. Sections are laid out in
+// command line order from 0x200, each at an even address, so the first
+// object holds the entry point. GLOBAL labels are visible to every object;
+// other labels only to their own.
+#define _POSIX_C_SOURCE 200809L // getopt
+#include "object.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ROM_START 0x200
+#define MEMORY_END 0x1000
+
+typedef struct {
+    const char *path;
+    Object object;
+    uint16_t base;           // address of the section
+} Input;
+
+typedef struct {
+    const char *name;
+    uint16_t address;
+    const char *path;
+} MapEntry;
+
+static Input *inputs;
+static int input_count;
+
+// Finds the object that exports `name`, or -1.
+static int find_global(const char *name, int *symbol) {
+    for (int i = 0; i < input_count; i++) {
+        const Object *object = &inputs[i].object;
+        for (int s = 0; s < object->symbol_count; s++) {
+            if (object->symbols[s].binding == SYMBOL_GLOBAL && strcmp(object->symbols[s].name, name) == 0) {
+                *symbol = s;
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+static int check_duplicates(void) {
+    int errors = 0;
+    for (int i = 0; i < input_count; i++) {
+        const Object *object = &inputs[i].object;
+        for (int s = 0; s < object->symbol_count; s++) {
+            if (object->symbols[s].binding != SYMBOL_GLOBAL) continue;
+            int first_symbol;
+            int first = find_global(object->symbols[s].name, &first_symbol);
+            if (first != i || first_symbol != s) {
+                fprintf(stderr, "%s: %s is also defined in %s\n", inputs[i].path,
+                        object->symbols[s].name, inputs[first].path);
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+static int lay_out(uint16_t *end) {
+    uint32_t address = ROM_START;
+    for (int i = 0; i < input_count; i++) {
+        address = (address + 1) & ~1u;
+        inputs[i].base = address;
+        address += inputs[i].object.code_size;
+        if (address > MEMORY_END) {
+            fprintf(stderr, "%s: program does not fit in memory, ends at 0x%X\n", inputs[i].path, address);
+            return 1;
+        }
+    }
+    *end = address;
+    return 0;
+}
+
+static int relocate(void) {
+    int errors = 0;
+    for (int i = 0; i < input_count; i++) {
+        Object *object = &inputs[i].object;
+        for (int r = 0; r < object->relocation_count; r++) {
+            const ObjectRelocation *relocation = &object->relocations[r];
+            const ObjectSymbol *symbol = &object->symbols[relocation->symbol];
+            uint32_t address;
+            if (symbol->binding == SYMBOL_EXTERN) {
+                int target_symbol;
+                int target = find_global(symbol->name, &target_symbol);
+                if (target < 0) {
+                    fprintf(stderr, "%s: undefined symbol %s\n", inputs[i].path, symbol->name);
+                    errors++;
+                    continue;
+                }
+                address = inputs[target].base + inputs[target].object.symbols[target_symbol].offset;
+            } else {
+                address = inputs[i].base + symbol->offset;
+            }
+            uint8_t *code = object->code + relocation->offset;
+            uint16_t instr = code[0] << 8 | code[1];
+            address += instr & 0xFFF; // addend left by the assembler
+            if (address > 0xFFF) {
+                fprintf(stderr, "%s: %s is out of range\n", inputs[i].path, symbol->name);
+                errors++;
+                continue;
+            }
+            instr = (instr & 0xF000) | address;
+            code[0] = instr >> 8;
+            code[1] = instr & 0xFF;
+        }
+    }
+    return errors;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const MapEntry *x = a, *y = b;
+    return x->address != y->address ? x->address - y->address : strcmp(x->name, y->name);
+}
+
+// One line per defined label, by address, for reading traces and dumps.
+static int write_map(const char *path) {
+    int count = 0;
+    for (int i = 0; i < input_count; i++) count += inputs[i].object.symbol_count;
+    MapEntry *entries = malloc((count + 1) * sizeof(MapEntry));
+    if (!entries) return 1;
+    int n = 0;
+    for (int i = 0; i < input_count; i++) {
+        const Object *object = &inputs[i].object;
+        for (int s = 0; s < object->symbol_count; s++) {
+            if (object->symbols[s].binding == SYMBOL_EXTERN) continue;
+            entries[n++] = (MapEntry){ object->symbols[s].name, inputs[i].base + object->symbols[s].offset, inputs[i].path };
+        }
+    }
+    qsort(entries, n, sizeof(MapEntry), compare_entries);
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        free(entries);
+        return 1;
+    }
+    for (int i = 0; i < n; i++) {
+        fprintf(out, "0x%03X %-31s %s\n", entries[i].address, entries[i].name, entries[i].path);
+    }
+    fclose(out);
+    free(entries);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = NULL;
+    const char *map = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:m:")) != -1) {
+        switch (opt) {
+            case 'o': output = optarg; break;
+            case 'm': map = optarg; break;
+            default: output = NULL; optind = argc; break;
+        }
+    }
+    if (!output || optind == argc) {
+        fprintf(stderr, "Usage: %s -o <output.rom> [-m <map>] <object.o8>...\n", argv[0]);
+        return 1;
+    }
+
+    input_count = argc - optind;
+    inputs = calloc(input_count, sizeof(Input));
+    for (int i = 0; i < input_count; i++) {
+        inputs[i].path = argv[optind + i];
+        if (!object_read(inputs[i].path, &inputs[i].object)) {
+            return 1;
+        }
+    }
+
+    uint16_t end;
+    if (check_duplicates() || lay_out(&end) || relocate()) {
+        return 1;
+    }
+
+    static uint8_t image[MEMORY_END - ROM_START];
+    for (int i = 0; i < input_count; i++) {
+        memcpy(image + inputs[i].base - ROM_START, inputs[i].object.code, inputs[i].object.code_size);
+    }
+    FILE *out = fopen(output, "wb");
+    if (!out) {
+        perror(output);
+        return 1;
+    }
+    fwrite(image, 1, end - ROM_START, out);
+    fclose(out);
+    if (map && write_map(map)) {
+        return 1;
+    }
+
+    for (int i = 0; i < input_count; i++) {
+        object_free(&inputs[i].object);
+    }
+    free(inputs);
+    return 0;
+}
@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, nanosleep
+#include "CHIP8.h"
+#include "library.h"
+#include "netplay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CPU_FREQ 500
+#define FRAME_RATE 60
+#define FRAME_NS (1000000000ULL / FRAME_RATE)
+#define HOLD_FRAMES 6            // scripted players change keys this often
+#define DRAIN_TICKS 600          // ticks allowed for the last inputs to arrive
+
+// Two peers in one process, talking over real UDP sockets on 127.0.0.1
+// through NetplayLink's artificial delay and loss, each with a scripted
+// player. Time is simulated, so a long session runs in seconds, unless -r
+// paces it at 60 Hz. At the end both peers must agree with a machine that
+// was given both players' inputs directly.
+
+typedef struct {
+    const char *rom;
+    long frames;
+    int delay_ms;
+    int jitter_ms;
+    int loss_percent;
+    int skew_percent;        // how much slower the second peer's clock runs
+    int cpu_freq;
+    int port;
+    bool realtime;
+} Options;
+
+typedef struct {
+    CHIP8 chip8;
+    Netplay netplay;
+    int player;
+    uint64_t tick_ns;        // this peer's frame period
+    uint64_t next_tick_ns;
+    uint64_t *advance_ns;    // wall time of every tick, for percentiles
+    long ticks;
+} Peer;
+
+// A player that holds one random key, or none, for HOLD_FRAMES at a time.
+static uint16_t scripted_keys(int player, uint32_t frame)
+{
+    uint32_t x = (frame / HOLD_FRAMES + 1) * 2654435761u ^ (player + 1) * 0x85EBCA6Bu;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35u;
+    x ^= x >> 16;
+    return x & 1 ? 1 << (x >> 8 & 0xF) : 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static bool open_peer(Peer *peer, const Options *options, int player, uint64_t rom_hash,
+                      const uint8_t *rom, size_t size, long max_ticks)
+{
+    InitializeCHIP8(&peer->chip8);
+    LoadROMImage(&peer->chip8, rom, size);
+    peer->player = player;
+    int local = options->port + player, remote = options->port + !player;
+    if (!NetplayOpen(&peer->netplay, local, "127.0.0.1", remote, rom_hash, options->cpu_freq)) {
+        return false;
+    }
+    NetplaySetLink(&peer->netplay, options->delay_ms, options->jitter_ms, options->loss_percent, 0x9E3779B97F4A7C15ULL * (player + 1));
+    peer->tick_ns = player ? FRAME_NS * (100 + options->skew_percent) / 100 : FRAME_NS;
+    peer->advance_ns = calloc(max_ticks, sizeof(uint64_t));
+    return peer->advance_ns != NULL;
+}
+
+// One frame tick of a peer. Past the last frame it only exchanges packets.
+static void tick(Peer *peer, const Options *options, uint64_t virtual_ns)
+{
+    uint64_t start = now_ns();
+    if (peer->netplay.frame < options->frames) {
+        NetplayAdvance(&peer->netplay, &peer->chip8, scripted_keys(peer->player, peer->netplay.frame), virtual_ns);
+    } else {
+        NetplayPoll(&peer->netplay, &peer->chip8, virtual_ns);
+    }
+    peer->advance_ns[peer->ticks++] = now_ns() - start;
+    peer->next_tick_ns += peer->tick_ns;
+}
+
+static bool settled(const Peer *peer, const Options *options)
+{
+    return peer->netplay.frame == options->frames && peer->netplay.remote_confirmed >= options->frames &&
+           peer->netplay.rollback_from == UINT32_MAX;
+}
+
+static void report(const Peer *peer)
+{
+    const NetplayStats *stats = &peer->netplay.stats;
+    uint64_t *times = malloc(peer->ticks * sizeof(uint64_t));
+    memcpy(times, peer->advance_ns, peer->ticks * sizeof(uint64_t));
+    qsort(times, peer->ticks, sizeof(uint64_t), compare_u64);
+    printf("peer %d: %llu frames, %llu stalls, %llu rollbacks (%.2f frames avg, %d max), "
+           "%llu/%llu packets sent/dropped, %llu received, %llu state checks, %llu desyncs\n",
+        peer->player, (unsigned long long)stats->frames, (unsigned long long)stats->stalls,
+        (unsigned long long)stats->rollbacks,
+        stats->rollbacks ? (double)stats->rollback_frames / stats->rollbacks : 0.0, stats->max_rollback,
+        (unsigned long long)stats->packets_sent, (unsigned long long)stats->packets_dropped,
+        (unsigned long long)stats->packets_received, (unsigned long long)stats->checks,
+        (unsigned long long)stats->desyncs);
+    printf("        tick time p50 %.1f us, p99 %.1f us, max %.1f us (budget %.0f us)\n",
+        times[peer->ticks / 2] / 1e3, times[peer->ticks * 99 / 100] / 1e3, times[peer->ticks - 1] / 1e3,
+        FRAME_NS / 1e3);
+    free(times);
+}
+
+int main(int argc, char *argv[])
+{
+    Options options = { .frames = 3600, .cpu_freq = CPU_FREQ, .port = 47800 };
+    int opt;
+    while ((opt = getopt(argc, argv, "f:d:j:l:s:c:p:r")) != -1) {
+        switch (opt) {
+            case 'f': options.frames = atol(optarg); break;
+            case 'd': options.delay_ms = atoi(optarg); break;
+            case 'j': options.jitter_ms = atoi(optarg); break;
+            case 'l': options.loss_percent = atoi(optarg); break;
+            case 's': options.skew_percent = atoi(optarg); break;
+            case 'c': options.cpu_freq = atoi(optarg); break;
+            case 'p': options.port = atoi(optarg); break;
+            case 'r': options.realtime = true; break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind != argc - 1 || options.frames <= 0 || options.cpu_freq <= 0) {
+        fprintf(stderr, "Usage: %s [-f frames] [-d delay ms] [-j jitter ms] [-l loss %%] [-s skew %%] "
+                        "[-c cycles/s] [-p port] [-r] <ROM>\n", argv[0]);
+        return 1;
+    }
+    options.rom = argv[optind];
+
+    static CHIP8 reference;
+    InitializeCHIP8(&reference);
+    long size = LoadROM(&reference, options.rom);
+    if (size < 0) {
+        return 1;
+    }
+    const uint8_t *rom = reference.ram + CHIP8_ROM_ADDR;
+    uint64_t rom_hash = LibraryHash(rom, size);
+
+    // generous: stalls can at most double the ticks a session takes
+    uint64_t give_up = (options.frames * 2 + DRAIN_TICKS) * FRAME_NS * (100 + options.skew_percent) / 100;
+    static Peer peers[2];
+    for (int i = 0; i < 2; i++) {
+        if (!open_peer(&peers[i], &options, i, rom_hash, rom, size, give_up / FRAME_NS + 2)) {
+            return 1;
+        }
+    }
+
+    // run both peers' ticks in time order until every frame is confirmed
+    uint64_t start = now_ns();
+    while (!(settled(&peers[0], &options) && settled(&peers[1], &options))) {
+        Peer *peer = peers[0].next_tick_ns <= peers[1].next_tick_ns ? &peers[0] : &peers[1];
+        uint64_t virtual_ns = peer->next_tick_ns;
+        if (virtual_ns > give_up) {
+            fprintf(stderr, "gave up: frames %u/%u, confirmed %u/%u\n",
+                peers[0].netplay.frame, peers[1].netplay.frame,
+                peers[0].netplay.remote_confirmed, peers[1].netplay.remote_confirmed);
+            return 1;
+        }
+        if (options.realtime) {
+            uint64_t now = now_ns() - start;
+            if (virtual_ns > now) {
+                nanosleep(&(struct timespec){ 0, virtual_ns - now }, NULL);
+            }
+        }
+        tick(peer, &options, virtual_ns);
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    for (uint32_t frame = 0; frame < options.frames; frame++) {
+        NetplayRunFrame(&reference, frame, options.cpu_freq, scripted_keys(0, frame) | scripted_keys(1, frame));
+    }
+    uint64_t expected = NetplayStateHash(&reference);
+    bool agree = true;
+    for (int i = 0; i < 2; i++) {
+        report(&peers[i]);
+        if (NetplayStateHash(&peers[i].chip8) != expected) {
+            printf("peer %d: final state differs from the reference run\n", i);
+            agree = false;
+        }
+        NetplayClose(&peers[i].netplay);
+    }
+    printf("%ld frames in %.2f s (%.1f simulated s): %s\n", options.frames, seconds,
+        (double)(peers[0].next_tick_ns > peers[1].next_tick_ns ? peers[0].next_tick_ns : peers[1].next_tick_ns) / 1e9,
+        agree ? "both peers match the reference" : "MISMATCH");
+    return agree ? 0 : 1;
+}
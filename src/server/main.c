@@ -0,0 +1,530 @@
+#define _GNU_SOURCE // accept4
+#include "protocol.h"
+#include "CHIP8.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#define CPU_FREQ 500
+#define FRAME_RATE 60
+#define MAX_EVENTS 256
+#define OUTPUT_SIZE 8192
+#define MAX_CATCH_UP 4 // frames a late worker may run back to back
+
+typedef struct Session Session;
+
+typedef struct Conn {
+    int fd;
+    Session *session;
+    struct Conn *next;       // next viewer of the same session, or next in an inbox
+    uint8_t input[CHIP8D_HEADER_SIZE + CHIP8D_MAX_PAYLOAD];
+    size_t input_len;
+    uint8_t output[OUTPUT_SIZE];
+    size_t output_len;
+    bool writable_armed;
+    uint32_t sent_seq;
+    uint32_t acked_seq;
+    Screen acked;            // the frame the client last acknowledged
+} Conn;
+
+struct Session {
+    CHIP8 chip8;
+    uint32_t id;
+    uint32_t seq;            // last published frame, 0 before the first
+    uint16_t keys;
+    Screen history[CHIP8D_HISTORY];
+    uint32_t history_seq[CHIP8D_HISTORY];
+    Conn *viewers;
+};
+
+typedef struct {
+    pthread_t thread;
+    int epoll_fd;
+    int timer_fd;
+    int wake_fd;
+    pthread_mutex_t lock;
+    Conn *inbox;             // connections handed over by the acceptor
+    Conn *closed;            // freed once the current batch of events is done
+    int index;
+    uint64_t frames;
+    uint64_t bytes_sent;
+    uint64_t dropped;        // diffs skipped because a client fell behind
+} Worker;
+
+static Session *sessions;
+static uint32_t session_count = 1;
+static Worker *workers;
+static int worker_count = 1;
+static atomic_bool running = true;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    atomic_store(&running, false);
+}
+
+// Later events in the same epoll batch may still point at the connection,
+// so workers park it on their closed list instead of freeing it right away.
+static void close_conn(Worker *worker, Conn *conn)
+{
+    Session *session = conn->session;
+    if (worker) {
+        for (Conn **link = &session->viewers; *link; link = &(*link)->next) {
+            if (*link == conn) {
+                *link = conn->next;
+                break;
+            }
+        }
+    }
+    close(conn->fd); // also removes it from the epoll set
+    conn->fd = -1;
+    if (worker) {
+        conn->next = worker->closed;
+        worker->closed = conn;
+    } else {
+        free(conn);
+    }
+}
+
+static bool flush_output(Conn *conn)
+{
+    while (conn->output_len > 0) {
+        ssize_t n = send(conn->fd, conn->output, conn->output_len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        memmove(conn->output, conn->output + n, conn->output_len - n);
+        conn->output_len -= n;
+    }
+    return true;
+}
+
+static void update_write_interest(Worker *worker, Conn *conn)
+{
+    bool want = conn->output_len > 0;
+    if (want == conn->writable_armed) {
+        return;
+    }
+    struct epoll_event event = { .events = EPOLLIN | (want ? EPOLLOUT : 0), .data.ptr = conn };
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->writable_armed = want;
+}
+
+// Queues the diff between the session's latest frame and the client's base.
+static void send_frame(Worker *worker, Conn *conn)
+{
+    Session *session = conn->session;
+    if (session->seq == 0 || conn->sent_seq == session->seq) {
+        return;
+    }
+    if (conn->sent_seq - conn->acked_seq >= CHIP8D_WINDOW) {
+        worker->dropped++;
+        return; // the client is behind, retried on the next tick
+    }
+    const uint64_t *screen = session->history[session->seq % CHIP8D_HISTORY];
+    uint8_t message[CHIP8D_HEADER_SIZE + CHIP8D_MAX_PAYLOAD];
+    uint8_t *rows = message + CHIP8D_HEADER_SIZE + 12;
+    uint32_t mask = 0;
+    for (int row = 0; row < 32; row++) {
+        uint64_t diff = screen[row] ^ conn->acked[row];
+        if (diff) {
+            mask |= 1u << row;
+            put_u64(rows, diff);
+            rows += 8;
+        }
+    }
+    size_t length = rows - message;
+    if (conn->output_len + length > sizeof(conn->output)) {
+        worker->dropped++;
+        return;
+    }
+    uint8_t *payload = put_header(message, MSG_FRAME, length - CHIP8D_HEADER_SIZE);
+    put_u32(payload, session->seq);
+    put_u32(payload + 4, conn->acked_seq);
+    put_u32(payload + 8, mask);
+    memcpy(conn->output + conn->output_len, message, length);
+    conn->output_len += length;
+    conn->sent_seq = session->seq;
+    worker->bytes_sent += length;
+}
+
+static void handle_message(Conn *conn, uint8_t type, const uint8_t *payload, uint16_t length)
+{
+    Session *session = conn->session;
+    switch (type) {
+        case MSG_KEYS:
+            if (length >= 2) session->keys = get_u16(payload);
+            break;
+        case MSG_ACK: {
+            if (length < 4) break;
+            uint32_t seq = get_u32(payload);
+            uint32_t slot = seq % CHIP8D_HISTORY;
+            if (seq <= conn->acked_seq || seq > conn->sent_seq) {
+                break;
+            }
+            if (session->history_seq[slot] == seq) {
+                memcpy(conn->acked, session->history[slot], sizeof(Screen));
+                conn->acked_seq = seq;
+            } else {
+                // the frame already left history, fall back to a keyframe
+                memset(conn->acked, 0, sizeof(Screen));
+                conn->acked_seq = 0;
+                conn->sent_seq = 0;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static bool read_input(Conn *conn)
+{
+    for (;;) {
+        ssize_t n = recv(conn->fd, conn->input + conn->input_len, sizeof(conn->input) - conn->input_len, 0);
+        if (n == 0) return false;
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+        conn->input_len += n;
+
+        size_t pos = 0;
+        while (conn->input_len - pos >= CHIP8D_HEADER_SIZE) {
+            uint16_t length = get_u16(conn->input + pos + 1);
+            if (length > CHIP8D_MAX_PAYLOAD) return false;
+            if (conn->input_len - pos < CHIP8D_HEADER_SIZE + length) break;
+            handle_message(conn, conn->input[pos], conn->input + pos + CHIP8D_HEADER_SIZE, length);
+            pos += CHIP8D_HEADER_SIZE + length;
+        }
+        memmove(conn->input, conn->input + pos, conn->input_len - pos);
+        conn->input_len -= pos;
+    }
+}
+
+static void run_frame(Worker *worker)
+{
+    // spread CPU_FREQ over the second the same way the frontend does
+    uint64_t frame = worker->frames;
+    int cycles = (int)((frame + 1) * CPU_FREQ / FRAME_RATE - frame * CPU_FREQ / FRAME_RATE);
+    for (uint32_t id = worker->index; id < session_count; id += worker_count) {
+        Session *session = &sessions[id];
+        CHIP8 *chip8 = &session->chip8;
+        UpdateKeypad(chip8, session->keys);
+        RunCycles(chip8, cycles);
+        UpdateTimers(chip8);
+        if (chip8->screen_changed) {
+            chip8->screen_changed = 0;
+            session->seq++;
+            uint32_t slot = session->seq % CHIP8D_HISTORY;
+            memcpy(session->history[slot], chip8->screen, sizeof(Screen));
+            session->history_seq[slot] = session->seq;
+        }
+        // viewers that were held back by the window catch up here too
+        for (Conn *conn = session->viewers; conn; ) {
+            Conn *next = conn->next;
+            send_frame(worker, conn);
+            if (!flush_output(conn)) {
+                close_conn(worker, conn);
+            } else {
+                update_write_interest(worker, conn);
+            }
+            conn = next;
+        }
+    }
+    worker->frames++;
+}
+
+static void adopt_inbox(Worker *worker)
+{
+    uint64_t value;
+    while (read(worker->wake_fd, &value, sizeof(value)) > 0);
+
+    pthread_mutex_lock(&worker->lock);
+    Conn *conn = worker->inbox;
+    worker->inbox = NULL;
+    pthread_mutex_unlock(&worker->lock);
+
+    while (conn) {
+        Conn *next = conn->next;
+        Session *session = conn->session;
+        conn->next = session->viewers;
+        session->viewers = conn;
+
+        uint8_t *payload = put_header(conn->output + conn->output_len, MSG_WELCOME, 5);
+        put_u32(payload, session->id);
+        payload[4] = 0;
+        conn->output_len += CHIP8D_HEADER_SIZE + 5;
+        send_frame(worker, conn); // the current screen as a keyframe
+
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+        if (!flush_output(conn)) {
+            close_conn(worker, conn);
+        } else {
+            update_write_interest(worker, conn);
+        }
+        conn = next;
+    }
+}
+
+static void *worker_thread(void *data)
+{
+    Worker *worker = data;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (atomic_load(&running)) {
+        int count = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, 100);
+        for (int i = 0; i < count; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &worker->timer_fd) {
+                uint64_t expirations = 0;
+                if (read(worker->timer_fd, &expirations, sizeof(expirations)) <= 0) continue;
+                if (expirations > MAX_CATCH_UP) expirations = MAX_CATCH_UP;
+                while (expirations--) run_frame(worker);
+                continue;
+            }
+            if (ptr == &worker->wake_fd) {
+                adopt_inbox(worker);
+                continue;
+            }
+            Conn *conn = ptr;
+            if (conn->fd < 0) {
+                continue; // closed earlier in this batch
+            }
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                close_conn(worker, conn);
+                continue;
+            }
+            if ((events[i].events & EPOLLIN) && !read_input(conn)) {
+                close_conn(worker, conn);
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && !flush_output(conn)) {
+                close_conn(worker, conn);
+                continue;
+            }
+            update_write_interest(worker, conn);
+        }
+        while (worker->closed) {
+            Conn *next = worker->closed->next;
+            free(worker->closed);
+            worker->closed = next;
+        }
+    }
+    return NULL;
+}
+
+static bool start_worker(Worker *worker, int index)
+{
+    worker->index = index;
+    pthread_mutex_init(&worker->lock, NULL);
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    worker->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    worker->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->epoll_fd < 0 || worker->timer_fd < 0 || worker->wake_fd < 0) {
+        perror("Failed to set up worker");
+        return false;
+    }
+    long period = 1000000000L / FRAME_RATE;
+    struct itimerspec spec = { .it_interval = { 0, period }, .it_value = { 0, period } };
+    timerfd_settime(worker->timer_fd, 0, &spec, NULL);
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &worker->timer_fd };
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->timer_fd, &event);
+    event.data.ptr = &worker->wake_fd;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &event);
+
+    if (pthread_create(&worker->thread, NULL, worker_thread, worker) != 0) {
+        perror("Failed to start worker");
+        return false;
+    }
+    return true;
+}
+
+static int listen_unix(const char *path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (fd < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Invalid socket path: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int listen_tcp(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK), // localhost only
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror("Failed to listen on TCP port");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads the HELLO of a pending connection and hands it to the owning worker.
+static void handshake(int epoll_fd, Conn *conn)
+{
+    ssize_t n = recv(conn->fd, conn->input + conn->input_len, sizeof(conn->input) - conn->input_len, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (n <= 0) {
+        close_conn(NULL, conn);
+        return;
+    }
+    conn->input_len += n;
+    if (conn->input_len < CHIP8D_HEADER_SIZE + 4) {
+        return;
+    }
+    uint32_t id = get_u32(conn->input + CHIP8D_HEADER_SIZE);
+    if (conn->input[0] != MSG_HELLO || id >= session_count) {
+        uint8_t reply[CHIP8D_HEADER_SIZE + 5];
+        uint8_t *payload = put_header(reply, MSG_WELCOME, 5);
+        put_u32(payload, id);
+        payload[4] = 1;
+        send(conn->fd, reply, sizeof(reply), MSG_NOSIGNAL);
+        close_conn(NULL, conn);
+        return;
+    }
+    // keep anything that followed the HELLO for the worker
+    size_t hello = CHIP8D_HEADER_SIZE + get_u16(conn->input + 1);
+    if (hello > conn->input_len) hello = conn->input_len;
+    memmove(conn->input, conn->input + hello, conn->input_len - hello);
+    conn->input_len -= hello;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->session = &sessions[id];
+    Worker *worker = &workers[id % worker_count];
+    pthread_mutex_lock(&worker->lock);
+    conn->next = worker->inbox;
+    worker->inbox = conn;
+    pthread_mutex_unlock(&worker->lock);
+    uint64_t one = 1;
+    write(worker->wake_fd, &one, sizeof(one));
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socket_path = NULL;
+    const char *rom = NULL;
+    int port = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            session_count = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            worker_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else {
+            rom = argv[i];
+        }
+    }
+    if (!rom || (!socket_path && !port) || session_count == 0 || worker_count <= 0) {
+        fprintf(stderr, "Usage: %s [-s sessions] [-t threads] [-u socket] [-p port] <ROM file>\n", argv[0]);
+        return 1;
+    }
+
+    // every session starts from the same loaded image
+    CHIP8 image;
+    InitializeCHIP8(&image);
+    if (LoadROM(&image, rom) < 0) {
+        return 1;
+    }
+    sessions = calloc(session_count, sizeof(Session));
+    workers = calloc(worker_count, sizeof(Worker));
+    if (!sessions || !workers) {
+        perror("Failed to allocate sessions");
+        return 1;
+    }
+    for (uint32_t id = 0; id < session_count; id++) {
+        sessions[id].chip8 = image;
+        sessions[id].id = id;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int listeners[2] = { -1, -1 };
+    if (socket_path && (listeners[0] = listen_unix(socket_path)) < 0) return 1;
+    if (port && (listeners[1] = listen_tcp(port)) < 0) return 1;
+    for (int i = 0; i < 2; i++) {
+        if (listeners[i] < 0) continue;
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = &listeners[i] };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listeners[i], &event);
+    }
+    for (int i = 0; i < worker_count; i++) {
+        if (!start_worker(&workers[i], i)) return 1;
+    }
+    fprintf(stderr, "chip8d: %u sessions on %d threads\n", session_count, worker_count);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (atomic_load(&running)) {
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, 500);
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == &listeners[0] || events[i].data.ptr == &listeners[1]) {
+                int listener = *(int *)events[i].data.ptr;
+                int fd;
+                while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    if (listener == listeners[1]) {
+                        int one = 1;
+                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    }
+                    Conn *conn = calloc(1, sizeof(Conn));
+                    if (!conn) {
+                        close(fd);
+                        continue;
+                    }
+                    conn->fd = fd;
+                    struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+                }
+            } else {
+                handshake(epoll_fd, events[i].data.ptr);
+            }
+        }
+    }
+
+    uint64_t frames = 0, bytes = 0, dropped = 0;
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        frames += workers[i].frames;
+        bytes += workers[i].bytes_sent;
+        dropped += workers[i].dropped;
+    }
+    fprintf(stderr, "chip8d: %llu worker frames, %llu bytes sent, %llu diffs dropped\n",
+        (unsigned long long)frames, (unsigned long long)bytes, (unsigned long long)dropped);
+    if (socket_path) unlink(socket_path);
+    return 0;
+}
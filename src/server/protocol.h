@@ -0,0 +1,73 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// chip8d wire protocol. Every message is a 3 byte header (type, little
+// endian payload length) followed by the payload; all integers are little
+// endian.
+//
+//   HELLO   client -> server  u32 session
+//   WELCOME server -> client  u32 session, u8 status (0 = ok)
+//   KEYS    client -> server  u16 keypad bits
+//   ACK     client -> server  u32 frame sequence the client has applied
+//   FRAME   server -> client  u32 seq, u32 base, u32 row mask, u64 per set row
+//
+// A FRAME carries the XOR of the new screen against frame `base`, the last
+// frame the client acknowledged (0 = blank screen). Only rows that changed
+// are sent.
+
+#define CHIP8D_HEADER_SIZE 3
+#define CHIP8D_MAX_PAYLOAD (12 + 32 * 8)
+#define CHIP8D_HISTORY 16 // frames kept on both ends to resolve bases
+#define CHIP8D_WINDOW 8   // unacknowledged frames in flight per client
+
+enum {
+    MSG_HELLO = 1,
+    MSG_WELCOME,
+    MSG_KEYS,
+    MSG_ACK,
+    MSG_FRAME,
+};
+
+static inline void put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static inline void put_u32(uint8_t *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) out[i] = value >> (8 * i);
+}
+
+static inline void put_u64(uint8_t *out, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) out[i] = value >> (8 * i);
+}
+
+static inline uint16_t get_u16(const uint8_t *in)
+{
+    return in[0] | in[1] << 8;
+}
+
+static inline uint32_t get_u32(const uint8_t *in)
+{
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static inline uint64_t get_u64(const uint8_t *in)
+{
+    return get_u32(in) | (uint64_t)get_u32(in + 4) << 32;
+}
+
+// Writes a header and returns a pointer to the payload.
+static inline uint8_t *put_header(uint8_t *out, uint8_t type, uint16_t length)
+{
+    out[0] = type;
+    put_u16(out + 1, length);
+    return out + CHIP8D_HEADER_SIZE;
+}
+
+#endif
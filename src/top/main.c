@@ -0,0 +1,167 @@
+#define _POSIX_C_SOURCE 200809L // nanosleep, kill
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#define MAX_INSTANCES 256
+#define NAME_SIZE (NAME_MAX + 2) // leading slash and terminator
+
+typedef struct {
+    char name[NAME_SIZE];
+    const StatsPage *page;
+    StatsEmulation emulation;
+    StatsRender render;
+    uint64_t previous_frames;
+    bool seen;               // found by the current scan
+} Instance;
+
+static Instance instances[MAX_INSTANCES];
+static int instance_count;
+
+static Instance *find_instance(const char *name)
+{
+    for (int i = 0; i < instance_count; i++) {
+        if (strcmp(instances[i].name, name) == 0) {
+            return &instances[i];
+        }
+    }
+    return NULL;
+}
+
+static void watch(const char *name)
+{
+    Instance *instance = find_instance(name);
+    if (instance) {
+        instance->seen = true;
+        return;
+    }
+    if (instance_count == MAX_INSTANCES) {
+        return;
+    }
+    const StatsPage *page = StatsAttach(name);
+    if (!page) {
+        return;
+    }
+    instance = &instances[instance_count++];
+    memset(instance, 0, sizeof(*instance));
+    snprintf(instance->name, sizeof(instance->name), "%s", name);
+    instance->page = page;
+    instance->seen = true;
+}
+
+// Every segment under STATS_SHM_DIR with our prefix, or only the given pids.
+static void scan(char **pids, int pid_count)
+{
+    for (int i = 0; i < instance_count; i++) {
+        instances[i].seen = false;
+    }
+    char name[NAME_SIZE];
+    if (pid_count) {
+        for (int i = 0; i < pid_count; i++) {
+            snprintf(name, sizeof(name), STATS_SHM_PREFIX "%s", pids[i]);
+            watch(name);
+        }
+    } else {
+        DIR *dir = opendir(STATS_SHM_DIR);
+        if (dir) {
+            struct dirent *entry;
+            while ((entry = readdir(dir))) {
+                if (strncmp(entry->d_name, STATS_SHM_PREFIX + 1, strlen(STATS_SHM_PREFIX) - 1) == 0) {
+                    snprintf(name, sizeof(name), "/%s", entry->d_name);
+                    watch(name);
+                }
+            }
+            closedir(dir);
+        }
+    }
+    // drop instances whose segment is gone or whose process has exited; a
+    // process that died without cleaning up leaves its segment behind
+    for (int i = 0; i < instance_count; ) {
+        Instance *instance = &instances[i];
+        bool alive = kill(instance->page->pid, 0) == 0 || errno == EPERM;
+        if (instance->seen && alive) {
+            i++;
+            continue;
+        }
+        if (!alive) {
+            shm_unlink(instance->name);
+        }
+        StatsDetach(instance->page);
+        instances[i] = instances[--instance_count];
+    }
+}
+
+static void print_table(double interval, bool clear)
+{
+    if (clear) {
+        printf("\033[H\033[2J");
+    }
+    printf("%-7s %-20s %-16s %6s %9s %15s %15s %6s %6s %8s\n",
+        "PID", "ROM", "HASH", "FPS", "IPS", "FRAME p50/p99", "DRAW p50/p99", "DROP", "SKIP", "UNDERRUN");
+    for (int i = 0; i < instance_count; i++) {
+        Instance *instance = &instances[i];
+        uint64_t previous = instance->previous_frames;
+        if (!StatsRead(instance->page, &instance->emulation, &instance->render)) {
+            printf("%-7d %-20.20s (busy or incompatible)\n", instance->page->pid, instance->page->rom_name);
+            continue;
+        }
+        const StatsEmulation *e = &instance->emulation;
+        const StatsRender *r = &instance->render;
+        instance->previous_frames = e->frames;
+        double fps = previous ? (e->frames - previous) / interval : 0;
+        char frame_times[32], draw_times[32];
+        snprintf(frame_times, sizeof(frame_times), "%.2f/%.2f ms", e->frame_p50_ns / 1e6, e->frame_p99_ns / 1e6);
+        snprintf(draw_times, sizeof(draw_times), "%.2f/%.2f ms", r->draw_p50_ns / 1e6, r->draw_p99_ns / 1e6);
+        printf("%-7d %-20.20s %016llx %6.1f %9llu %15s %15s %6llu %6llu %8llu\n",
+            instance->page->pid, instance->page->rom_name, (unsigned long long)instance->page->rom_hash,
+            fps, (unsigned long long)e->ips, frame_times, draw_times,
+            (unsigned long long)e->dropped_frames, (unsigned long long)e->skipped_frames,
+            (unsigned long long)e->audio_underruns);
+    }
+    if (instance_count == 0) {
+        printf("no running instances\n");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    double delay = 1.0;
+    long iterations = 0;
+    bool batch = false;
+    char *pids[MAX_INSTANCES];
+    int pid_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            delay = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0) {
+            batch = true;
+        } else if (argv[i][0] != '-' && pid_count < MAX_INSTANCES) {
+            pids[pid_count++] = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [-d seconds] [-n iterations] [-b] [pid...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (delay <= 0) delay = 1.0;
+
+    for (long iteration = 0; !iterations || iteration < iterations; iteration++) {
+        if (iteration) {
+            struct timespec pause = { (time_t)delay, (long)((delay - (time_t)delay) * 1e9) };
+            nanosleep(&pause, NULL);
+        }
+        scan(pids, pid_count);
+        print_table(delay, !batch);
+    }
+    return 0;
+}
@@ -0,0 +1,297 @@
+#include "disassembler.h"
+#include "trace_format.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define MAX_LOOPS 1024
+#define TOP_RANGES 10
+
+typedef struct {
+    uint32_t seq;          // record number
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t changed;      // registers written by this instruction
+    uint8_t registers[16]; // state after the instruction
+    uint16_t index;
+    bool gap;
+} TraceRecord;
+
+typedef struct {
+    FILE *file;
+    uint32_t seq;
+    uint16_t next_pc;
+    uint8_t registers[16];
+    uint16_t index;
+} TraceReader;
+
+typedef struct {
+    uint16_t head;         // jump target
+    uint16_t tail;         // address of the backward jump
+    uint64_t iterations;
+    int depth;
+} Loop;
+
+static bool open_trace(TraceReader *reader, const char *path)
+{
+    reader->file = fopen(path, "rb");
+    if (!reader->file) {
+        perror(path);
+        return false;
+    }
+    uint8_t header[TRACE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header) ||
+        memcmp(header, TRACE_MAGIC, 4) != 0 || header[4] != TRACE_VERSION) {
+        fprintf(stderr, "%s: not a version %d trace\n", path, TRACE_VERSION);
+        fclose(reader->file);
+        return false;
+    }
+    memcpy(reader->registers, header + 5, 16);
+    reader->index = header[21] | header[22] << 8;
+    reader->seq = 0;
+    reader->next_pc = 0xFFFF;
+    return true;
+}
+
+static int read_u8(FILE *file)
+{
+    return fgetc(file);
+}
+
+static int read_u16le(FILE *file)
+{
+    int lo = fgetc(file), hi = fgetc(file);
+    return (lo < 0 || hi < 0) ? -1 : lo | hi << 8;
+}
+
+// Decodes the next record and applies it to the reconstructed state.
+static bool next_record(TraceReader *reader, TraceRecord *record)
+{
+    int flags = read_u8(reader->file);
+    if (flags < 0) {
+        return false;
+    }
+    int pc = reader->next_pc;
+    if (flags & TRACE_PC) {
+        pc = read_u16le(reader->file);
+    }
+    int hi = read_u8(reader->file), lo = read_u8(reader->file);
+    if (pc < 0 || hi < 0 || lo < 0) {
+        return false;
+    }
+    record->changed = 0;
+    if (flags & TRACE_REGS) {
+        int changed = read_u16le(reader->file);
+        if (changed < 0) return false;
+        record->changed = changed;
+        for (int r = 0; r < 16; r++) {
+            if (!(changed & (1 << r))) continue;
+            int value = read_u8(reader->file);
+            if (value < 0) return false; // truncated, e.g. killed mid-flush
+            reader->registers[r] = value;
+        }
+    }
+    if (flags & TRACE_INDEX) {
+        int index = read_u16le(reader->file);
+        if (index < 0) return false;
+        reader->index = index;
+    }
+    record->seq = reader->seq++;
+    record->pc = pc;
+    record->opcode = hi << 8 | lo;
+    record->gap = flags & TRACE_GAP;
+    record->index = reader->index;
+    memcpy(record->registers, reader->registers, 16);
+    reader->next_pc = pc + 2;
+    return true;
+}
+
+static void format_record(const TraceRecord *record, char *out, size_t size)
+{
+    char text[MAX_OPCODE_LEN];
+    Instruction instruction = { .raw = record->opcode };
+    if (disassemble(instruction, text, sizeof(text)) != SUCCESS) {
+        snprintf(text, sizeof(text), "DB 0x%04X", record->opcode);
+    }
+    int n = snprintf(out, size, "%8u  0x%03X  %04X  %-20s I=0x%03X", record->seq, record->pc, record->opcode, text, record->index);
+    for (int r = 0; r < 16 && n < (int)size; r++) {
+        if (record->changed & (1 << r)) {
+            n += snprintf(out + n, size - n, " V%X=%02X", r, record->registers[r]);
+        }
+    }
+}
+
+static int dump(const char *path)
+{
+    TraceReader reader;
+    if (!open_trace(&reader, path)) return 1;
+    TraceRecord record;
+    char line[256];
+    while (next_record(&reader, &record)) {
+        if (record.gap) puts("   ... records dropped ...");
+        format_record(&record, line, sizeof(line));
+        puts(line);
+    }
+    fclose(reader.file);
+    return 0;
+}
+
+static int compare_ranges(const void *a, const void *b)
+{
+    const uint64_t *x = a, *y = b;
+    return x[0] < y[0] ? 1 : x[0] > y[0] ? -1 : 0;
+}
+
+static int compare_loops(const void *a, const void *b)
+{
+    const Loop *x = a, *y = b;
+    if (x->head != y->head) return x->head - y->head;
+    return y->tail - x->tail; // outer loops first
+}
+
+static int report(const char *path)
+{
+    TraceReader reader;
+    if (!open_trace(&reader, path)) return 1;
+
+    static uint64_t hits[4096];
+    static uint16_t opcodes[4096];
+    static Loop loops[MAX_LOOPS];
+    int loop_count = 0;
+    uint64_t total = 0;
+
+    TraceRecord record, previous = { .pc = 0xFFFF };
+    while (next_record(&reader, &record)) {
+        hits[record.pc & 0xFFF]++;
+        opcodes[record.pc & 0xFFF] = record.opcode;
+        total++;
+        // a backward control transfer other than a return closes a loop iteration
+        if (previous.pc != 0xFFFF && !record.gap && record.pc <= previous.pc && previous.opcode != 0x00EE) {
+            int i;
+            for (i = 0; i < loop_count; i++) {
+                if (loops[i].head == record.pc && loops[i].tail == previous.pc) break;
+            }
+            if (i == loop_count && loop_count < MAX_LOOPS) {
+                loops[loop_count++] = (Loop) { .head = record.pc, .tail = previous.pc };
+            }
+            if (i < loop_count) loops[i].iterations++;
+        }
+        previous = record;
+    }
+    fclose(reader.file);
+    if (total == 0) {
+        puts("empty trace");
+        return 0;
+    }
+    printf("%llu instructions\n\n", (unsigned long long)total);
+
+    // hot ranges: runs of consecutive executed instructions
+    static uint64_t ranges[2048][3]; // count, start, end
+    int range_count = 0;
+    for (int pc = 0; pc < 4096; pc++) {
+        if (!hits[pc]) continue;
+        if (range_count && ranges[range_count - 1][2] + 2 == (uint64_t)pc) {
+            ranges[range_count - 1][0] += hits[pc];
+            ranges[range_count - 1][2] = pc;
+        } else if (range_count < 2048) {
+            ranges[range_count][0] = hits[pc];
+            ranges[range_count][1] = pc;
+            ranges[range_count][2] = pc;
+            range_count++;
+        }
+    }
+    qsort(ranges, range_count, sizeof(ranges[0]), compare_ranges);
+    printf("Hot ranges:\n");
+    for (int i = 0; i < range_count && i < TOP_RANGES; i++) {
+        uint16_t hottest = ranges[i][1];
+        for (uint64_t pc = ranges[i][1]; pc <= ranges[i][2]; pc += 2) {
+            if (hits[pc] > hits[hottest]) hottest = pc;
+        }
+        char text[MAX_OPCODE_LEN];
+        if (disassemble((Instruction) { .raw = opcodes[hottest] }, text, sizeof(text)) != SUCCESS) {
+            snprintf(text, sizeof(text), "DB 0x%04X", opcodes[hottest]);
+        }
+        printf("  0x%03llX-0x%03llX  %6.2f%%  hottest 0x%03X %s\n",
+            (unsigned long long)ranges[i][1], (unsigned long long)ranges[i][2],
+            100.0 * ranges[i][0] / total, hottest, text);
+    }
+
+    // loop nests: a loop is nested in every loop whose body encloses it
+    qsort(loops, loop_count, sizeof(Loop), compare_loops);
+    printf("\nLoops:\n");
+    for (int i = 0; i < loop_count; i++) {
+        for (int j = 0; j < i; j++) {
+            if (loops[j].head <= loops[i].head && loops[i].tail <= loops[j].tail) {
+                loops[i].depth = loops[j].depth + 1;
+            }
+        }
+        printf("  %*s0x%03X-0x%03X  %llu iterations\n", 2 * loops[i].depth, "",
+            loops[i].head, loops[i].tail, (unsigned long long)loops[i].iterations);
+    }
+    return 0;
+}
+
+static bool same_record(const TraceRecord *a, const TraceRecord *b)
+{
+    return a->pc == b->pc && a->opcode == b->opcode && a->index == b->index &&
+           memcmp(a->registers, b->registers, 16) == 0;
+}
+
+static int diverge(const char *path_a, const char *path_b)
+{
+    TraceReader a, b;
+    if (!open_trace(&a, path_a)) return 1;
+    if (!open_trace(&b, path_b)) {
+        fclose(a.file);
+        return 1;
+    }
+    // keep a little history to show how the traces got there
+    enum { CONTEXT = 4 };
+    TraceRecord history[CONTEXT];
+    int kept = 0;
+    TraceRecord ra, rb;
+    char line[256];
+    int status = 0;
+    for (;;) {
+        bool more_a = next_record(&a, &ra), more_b = next_record(&b, &rb);
+        if (!more_a && !more_b) {
+            printf("traces are identical (%u records)\n", a.seq);
+            break;
+        }
+        if (more_a != more_b || !same_record(&ra, &rb)) {
+            printf("traces diverge at record %u\n", more_a ? ra.seq : rb.seq);
+            for (int i = kept > CONTEXT ? kept - CONTEXT : 0; i < kept; i++) {
+                format_record(&history[i % CONTEXT], line, sizeof(line));
+                printf("    %s\n", line);
+            }
+            if (more_a) { format_record(&ra, line, sizeof(line)); printf("  a %s\n", line); }
+            else printf("  a <end of trace>\n");
+            if (more_b) { format_record(&rb, line, sizeof(line)); printf("  b %s\n", line); }
+            else printf("  b <end of trace>\n");
+            status = 2;
+            break;
+        }
+        history[kept++ % CONTEXT] = ra;
+    }
+    fclose(a.file);
+    fclose(b.file);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "dump") == 0) {
+        return dump(argv[2]);
+    }
+    if (argc == 3 && strcmp(argv[1], "report") == 0) {
+        return report(argv[2]);
+    }
+    if (argc == 4 && strcmp(argv[1], "diff") == 0) {
+        return diverge(argv[2], argv[3]);
+    }
+    fprintf(stderr, "Usage: %s dump <trace>\n", argv[0]);
+    fprintf(stderr, "       %s report <trace>\n", argv[0]);
+    fprintf(stderr, "       %s diff <trace a> <trace b>\n", argv[0]);
+    return 1;
+}